@@ -0,0 +1,440 @@
+#include "BlockCompression.h"
+#include "defs.h"
+#include "util.h"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+int blockBytes(int format)
+{
+	return format == TEXFORMAT_BC1 ? 8 : 16;
+}
+
+static void expand565(uint32_t c, unsigned char* rgba)
+{
+	uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	rgba[0] = (unsigned char)((r << 3) | (r >> 2));
+	rgba[1] = (unsigned char)((g << 2) | (g >> 4));
+	rgba[2] = (unsigned char)((b << 3) | (b >> 2));
+	rgba[3] = 255;
+}
+
+// color block shared by BC1 and BC3; BC3 always uses the 4 color mode
+static void decodeColorBlock(const unsigned char* block, unsigned char* rgba, bool four_colors)
+{
+	uint32_t c0 = block[0] | (block[1] << 8);
+	uint32_t c1 = block[2] | (block[3] << 8);
+	unsigned char palette[4][4];
+	expand565(c0, palette[0]);
+	expand565(c1, palette[1]);
+	if (four_colors || c0 > c1)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (unsigned char)((2 * palette[0][c] + palette[1][c]) / 3);
+			palette[3][c] = (unsigned char)((palette[0][c] + 2 * palette[1][c]) / 3);
+		}
+		palette[2][3] = palette[3][3] = 255;
+	}
+	else
+	{
+		for (int c = 0; c < 3; c++)
+			palette[2][c] = (unsigned char)((palette[0][c] + palette[1][c]) / 2);
+		palette[2][3] = 255;
+		palette[3][0] = palette[3][1] = palette[3][2] = palette[3][3] = 0;
+	}
+	uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+	for (int i = 0; i < 16; i++)
+		memcpy(&rgba[4 * i], palette[(indices >> (2 * i)) & 3], 4);
+}
+
+void decodeBC1(const unsigned char* block, unsigned char* rgba)
+{
+	decodeColorBlock(block, rgba, false);
+}
+
+void decodeBC3(const unsigned char* block, unsigned char* rgba)
+{
+	decodeColorBlock(block + 8, rgba, true);
+
+	int a0 = block[0], a1 = block[1];
+	unsigned char palette[8];
+	palette[0] = (unsigned char)a0;
+	palette[1] = (unsigned char)a1;
+	if (a0 > a1)
+	{
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = (unsigned char)(((7 - i) * a0 + i * a1) / 7);
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = (unsigned char)(((5 - i) * a0 + i * a1) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++)
+		indices |= (uint64_t)block[2 + i] << (8 * i);
+	for (int i = 0; i < 16; i++)
+		rgba[4 * i + 3] = palette[(indices >> (3 * i)) & 7];
+}
+
+// BC7 [Khronos Data Format Specification, BPTC]
+
+struct BC7Mode
+{
+	int m_subsets;
+	int m_partition_bits;
+	int m_rotation_bits;
+	int m_selection_bits;
+	int m_color_bits;
+	int m_alpha_bits;
+	int m_endpoint_pbits;
+	int m_shared_pbits;
+	int m_index_bits;
+	int m_index_bits2;
+};
+
+static const BC7Mode BC7_MODES[8] =
+{
+	{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+	{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+// subset 1 texels of the 2 subset partitions, one bit per texel
+static const uint16_t BC7_PARTITIONS_2[64] =
+{
+	0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+	0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+	0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+	0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+	0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+	0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+	0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+	0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+
+// subset of each texel of the 3 subset partitions, two bits per texel
+static const uint32_t BC7_PARTITIONS_3[64] =
+{
+	0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050,
+	0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250,
+	0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+	0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200,
+	0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50,
+	0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+	0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414, 0x96960000,
+	0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+};
+
+// texels whose index has an implicit 0 high bit, besides texel 0: of subset 1 for 2 subsets,
+// of subsets 1 and 2 for 3 subsets
+static const uint8_t BC7_ANCHORS_2[64] =
+{
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+	15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+	6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15,
+};
+
+static const uint8_t BC7_ANCHORS_3_1[64] =
+{
+	3, 3, 15, 15, 8, 3, 15, 15, 8, 8, 6, 6, 6, 5, 3, 3,
+	3, 3, 8, 15, 3, 3, 6, 10, 5, 8, 8, 6, 8, 5, 15, 15,
+	8, 15, 3, 5, 6, 10, 8, 15, 15, 3, 15, 5, 15, 15, 15, 15,
+	3, 15, 5, 5, 5, 8, 5, 10, 5, 10, 8, 13, 15, 12, 3, 3,
+};
+
+static const uint8_t BC7_ANCHORS_3_2[64] =
+{
+	15, 8, 8, 3, 15, 15, 3, 8, 15, 15, 15, 15, 15, 15, 15, 8,
+	15, 8, 15, 3, 15, 8, 15, 8, 3, 15, 6, 10, 15, 15, 10, 8,
+	15, 3, 15, 10, 10, 8, 9, 10, 6, 15, 8, 15, 3, 6, 6, 8,
+	15, 3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 15, 15, 8,
+};
+
+static const int BC7_WEIGHTS_2[4] = { 0, 21, 43, 64 };
+static const int BC7_WEIGHTS_3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const int BC7_WEIGHTS_4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BitReader
+{
+	const unsigned char* m_data;
+	int m_pos;
+
+	uint32_t read(int bits)
+	{
+		uint32_t v = 0;
+		for (int i = 0; i < bits; i++, m_pos++)
+			v |= ((m_data[m_pos >> 3] >> (m_pos & 7)) & 1u) << i;
+		return v;
+	}
+};
+
+static int bc7Weight(int bits, int index)
+{
+	return bits == 2 ? BC7_WEIGHTS_2[index] : (bits == 3 ? BC7_WEIGHTS_3[index] : BC7_WEIGHTS_4[index]);
+}
+
+// replicates the high bits of an n bit value into the low bits of 8
+static int bc7Expand(int v, int bits)
+{
+	v <<= 8 - bits;
+	return v | (v >> bits);
+}
+
+void decodeBC7(const unsigned char* block, unsigned char* rgba)
+{
+	int m = 0;
+	while (m < 8 && !(block[0] & (1 << m)))
+		m++;
+	if (m == 8)
+	{
+		// reserved mode
+		memset(rgba, 0, 64);
+		return;
+	}
+	const BC7Mode& mode = BC7_MODES[m];
+	BitReader bits = { block, m + 1 };
+
+	int partition = bits.read(mode.m_partition_bits);
+	int rotation = bits.read(mode.m_rotation_bits);
+	int selection = bits.read(mode.m_selection_bits);
+
+	int num_endpoints = 2 * mode.m_subsets;
+	int endpoints[6][4];
+	for (int c = 0; c < 3; c++)
+		for (int e = 0; e < num_endpoints; e++)
+			endpoints[e][c] = bits.read(mode.m_color_bits);
+	for (int e = 0; e < num_endpoints; e++)
+		endpoints[e][3] = mode.m_alpha_bits ? bits.read(mode.m_alpha_bits) : 255;
+
+	int color_bits = mode.m_color_bits, alpha_bits = mode.m_alpha_bits;
+	if (mode.m_endpoint_pbits || mode.m_shared_pbits)
+	{
+		int pbits[6];
+		for (int e = 0; e < num_endpoints; e++)
+		{
+			// shared bits: one per subset, for both its endpoints
+			if (mode.m_endpoint_pbits || (e & 1) == 0)
+				pbits[e] = bits.read(1);
+			else
+				pbits[e] = pbits[e - 1];
+		}
+		for (int e = 0; e < num_endpoints; e++)
+			for (int c = 0; c < (alpha_bits ? 4 : 3); c++)
+				endpoints[e][c] = (endpoints[e][c] << 1) | pbits[e];
+		color_bits++;
+		if (alpha_bits)
+			alpha_bits++;
+	}
+	for (int e = 0; e < num_endpoints; e++)
+	{
+		for (int c = 0; c < 3; c++)
+			endpoints[e][c] = bc7Expand(endpoints[e][c], color_bits);
+		if (alpha_bits)
+			endpoints[e][3] = bc7Expand(endpoints[e][3], alpha_bits);
+	}
+
+	int subsets[16], indices[16], indices2[16];
+	for (int i = 0; i < 16; i++)
+	{
+		if (mode.m_subsets == 2)
+			subsets[i] = (BC7_PARTITIONS_2[partition] >> i) & 1;
+		else if (mode.m_subsets == 3)
+			subsets[i] = (BC7_PARTITIONS_3[partition] >> (2 * i)) & 3;
+		else
+			subsets[i] = 0;
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		bool anchor = i == 0 ||
+			(mode.m_subsets == 2 && i == BC7_ANCHORS_2[partition]) ||
+			(mode.m_subsets == 3 && (i == BC7_ANCHORS_3_1[partition] || i == BC7_ANCHORS_3_2[partition]));
+		indices[i] = bits.read(mode.m_index_bits - (anchor ? 1 : 0));
+	}
+	if (mode.m_index_bits2)
+	{
+		for (int i = 0; i < 16; i++)
+			indices2[i] = bits.read(mode.m_index_bits2 - (i == 0 ? 1 : 0));
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		const int* e0 = endpoints[2 * subsets[i]];
+		const int* e1 = endpoints[2 * subsets[i] + 1];
+		int color_weight, alpha_weight;
+		if (!mode.m_index_bits2)
+			color_weight = alpha_weight = bc7Weight(mode.m_index_bits, indices[i]);
+		else if (selection)
+		{
+			color_weight = bc7Weight(mode.m_index_bits2, indices2[i]);
+			alpha_weight = bc7Weight(mode.m_index_bits, indices[i]);
+		}
+		else
+		{
+			color_weight = bc7Weight(mode.m_index_bits, indices[i]);
+			alpha_weight = bc7Weight(mode.m_index_bits2, indices2[i]);
+		}
+		unsigned char* t = &rgba[4 * i];
+		for (int c = 0; c < 3; c++)
+			t[c] = (unsigned char)((e0[c] * (64 - color_weight) + e1[c] * color_weight + 32) >> 6);
+		t[3] = (unsigned char)((e0[3] * (64 - alpha_weight) + e1[3] * alpha_weight + 32) >> 6);
+		if (rotation)
+			std::swap(t[3], t[rotation - 1]);
+	}
+}
+
+void decodeBlock(int format, const unsigned char* block, unsigned char* rgba)
+{
+	switch (format)
+	{
+	case TEXFORMAT_BC1:
+		decodeBC1(block, rgba);
+		break;
+	case TEXFORMAT_BC3:
+		decodeBC3(block, rgba);
+		break;
+	case TEXFORMAT_BC7:
+		decodeBC7(block, rgba);
+		break;
+	default:
+		memset(rgba, 255, 64);
+	}
+}
+
+bool isCompressedImageFile(const std::string& filename)
+{
+	size_t dot = filename.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string ext = tolowerCase(filename.substr(dot + 1));
+	return ext == "dds" || ext == "ktx";
+}
+
+static uint32_t readU32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// fills the mip level offsets of the image, keeping the levels present in the file
+static bool setLevels(CompressedImage& image, int num_levels, size_t data_size)
+{
+	int width = image.m_width, height = image.m_height;
+	size_t offset = 0;
+	for (int l = 0; l < num_levels; l++)
+	{
+		size_t size = (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(image.m_format);
+		if (offset + size > data_size)
+			break;
+		image.m_levels.push_back(offset);
+		offset += size;
+		if (width == 1 && height == 1)
+			break;
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	return !image.m_levels.empty();
+}
+
+static bool readDDS(const std::vector<unsigned char>& file, CompressedImage& image)
+{
+	// magic, 124 byte header with the pixel format at 76, optional 20 byte DX10 header
+	if (file.size() < 128 || memcmp(file.data(), "DDS ", 4) != 0)
+		return false;
+	const unsigned char* header = &file[4];
+	image.m_height = (int)readU32(header + 8);
+	image.m_width = (int)readU32(header + 12);
+	int num_levels = std::max(1, (int)readU32(header + 24));
+	const unsigned char* fourcc = header + 80;
+	size_t data_offset = 128;
+
+	if (memcmp(fourcc, "DXT1", 4) == 0)
+		image.m_format = TEXFORMAT_BC1;
+	else if (memcmp(fourcc, "DXT5", 4) == 0)
+		image.m_format = TEXFORMAT_BC3;
+	else if (memcmp(fourcc, "DX10", 4) == 0 && file.size() >= 148)
+	{
+		switch (readU32(&file[128]))
+		{
+		case 70: case 71: case 72:
+			image.m_format = TEXFORMAT_BC1;
+			break;
+		case 76: case 77: case 78:
+			image.m_format = TEXFORMAT_BC3;
+			break;
+		case 97: case 98: case 99:
+			image.m_format = TEXFORMAT_BC7;
+			break;
+		}
+		data_offset = 148;
+	}
+	if (!image.m_format || image.m_width <= 0 || image.m_height <= 0)
+		return false;
+
+	image.m_data.assign(file.begin() + data_offset, file.end());
+	return setLevels(image, num_levels, image.m_data.size());
+}
+
+static bool readKTX(const std::vector<unsigned char>& file, CompressedImage& image)
+{
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	// identifier and 13 32-bit fields, little endian files only
+	if (file.size() < 64 || memcmp(file.data(), identifier, 12) != 0 || readU32(&file[12]) != 0x04030201)
+		return false;
+	switch (readU32(&file[28]))
+	{
+	case 0x83F0: case 0x83F1: case 0x8C4C: case 0x8C4D: // S3TC DXT1 (RGB, RGBA, sRGB)
+		image.m_format = TEXFORMAT_BC1;
+		break;
+	case 0x83F3: case 0x8C4F: // S3TC DXT5
+		image.m_format = TEXFORMAT_BC3;
+		break;
+	case 0x8E8C: case 0x8E8D: // BPTC
+		image.m_format = TEXFORMAT_BC7;
+		break;
+	}
+	image.m_width = (int)readU32(&file[36]);
+	image.m_height = (int)std::max(1u, readU32(&file[40]));
+	int num_levels = std::max(1, (int)readU32(&file[56]));
+	size_t offset = 64 + (size_t)readU32(&file[60]);
+	if (!image.m_format || image.m_width <= 0)
+		return false;
+
+	// each level is preceded by its size
+	for (int l = 0; l < num_levels && offset + 4 <= file.size(); l++)
+	{
+		size_t size = readU32(&file[offset]);
+		offset += 4;
+		if (offset + size > file.size())
+			break;
+		image.m_data.insert(image.m_data.end(), file.begin() + offset, file.begin() + offset + size);
+		offset += (size + 3) & ~(size_t)3;
+	}
+	return setLevels(image, num_levels, image.m_data.size());
+}
+
+bool readCompressedImage(const std::string& filename, CompressedImage& image)
+{
+	FILE* f;
+	if (fopen_s(&f, filename.c_str(), "rb") != 0)
+		return false;
+	std::vector<unsigned char> file;
+	unsigned char buffer[65536];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		file.insert(file.end(), buffer, buffer + count);
+	fclose(f);
+
+	image = CompressedImage();
+	if (file.size() >= 4 && memcmp(file.data(), "DDS ", 4) == 0)
+		return readDDS(file, image);
+	return readKTX(file, image);
+}
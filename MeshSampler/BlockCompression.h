@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Decoding of block-compressed textures, 4x4 texels per block.
+
+#define TEX_BLOCK_SIZE 4
+
+// bytes per block of a TEXFORMAT_BC* format
+int blockBytes(int format);
+
+// decode a block of a TEXFORMAT_BC* format into 16 RGBA texels, row by row, top row first
+void decodeBC1(const unsigned char* block, unsigned char* rgba);
+void decodeBC3(const unsigned char* block, unsigned char* rgba);
+void decodeBC7(const unsigned char* block, unsigned char* rgba);
+void decodeBlock(int format, const unsigned char* block, unsigned char* rgba);
+
+struct CompressedImage
+{
+	int m_format = 0;
+	int m_width = 0;
+	int m_height = 0;
+	std::vector<size_t> m_levels; // byte offset of each mip level in m_data
+	std::vector<unsigned char> m_data;
+};
+
+// true for the file types read by readCompressedImage (by extension)
+bool isCompressedImageFile(const std::string& filename);
+// reads the BC1, BC3 (DXT5) or BC7 mip levels of a DDS or KTX 1 file
+bool readCompressedImage(const std::string& filename, CompressedImage& image);
@@ -0,0 +1,102 @@
+#include "MappedFile.h"
+#include <cstdint>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string& filename, bool copy_on_write)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	void* data = MapViewOfFile(mapping, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_mapping = mapping;
+	m_size = (size_t)size.QuadPart;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* data = mmap(nullptr, (size_t)st.st_size, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ,
+		copy_on_write ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		::close(fd);
+		return false;
+	}
+	m_fd = fd;
+	m_size = (size_t)st.st_size;
+#endif
+	m_data = static_cast<const unsigned char*>(data);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!m_data)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+	m_mapping = m_file = nullptr;
+#else
+	munmap((void*)m_data, m_size);
+	::close(m_fd);
+	m_fd = -1;
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+void MappedFile::advise(const void* data, size_t size, int advice) const
+{
+	if (!m_data || size == 0)
+		return;
+#ifdef _WIN32
+	// only prefetching has an equivalent
+	if (advice != MAPPED_ADVICE_WILLNEED)
+		return;
+	WIN32_MEMORY_RANGE_ENTRY range = { (PVOID)data, size };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	// madvise takes page aligned ranges
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	uintptr_t first = (uintptr_t)data & ~(uintptr_t)(page - 1);
+	uintptr_t last = (uintptr_t)data + size;
+	int flags[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+	madvise((void*)first, last - first, flags[advice]);
+#endif
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <utility>
+
+// access pattern hints of mapped ranges
+#define MAPPED_ADVICE_NORMAL 0
+#define MAPPED_ADVICE_SEQUENTIAL 1
+#define MAPPED_ADVICE_RANDOM 2
+#define MAPPED_ADVICE_WILLNEED 3
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+	const unsigned char* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+
+	// copy_on_write: the mapping can be modified, without changing the file
+	bool open(const std::string& filename, bool copy_on_write = false);
+	void close();
+	// hints the access pattern of size bytes at data, within the mapping
+	void advise(const void* data, size_t size, int advice) const;
+	bool isOpen() const { return m_data != nullptr; }
+	void swap(MappedFile& other)
+	{
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+#ifdef _WIN32
+		std::swap(m_file, other.m_file);
+		std::swap(m_mapping, other.m_mapping);
+#else
+		std::swap(m_fd, other.m_fd);
+#endif
+	}
+
+	const unsigned char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+};
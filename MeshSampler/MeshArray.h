@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+// Array of mesh attributes, either held in memory or viewing elements of a memory mapped file.
+// Views are mapped copy-on-write, so elements can be modified in place; calls that change the
+// size copy the elements to memory first.
+template <typename T>
+class MeshArray
+{
+	std::vector<T> m_owned;
+	T* m_data = nullptr;
+	size_t m_size = 0;
+	bool m_mapped = false;
+
+	void sync()
+	{
+		m_data = m_owned.data();
+		m_size = m_owned.size();
+	}
+	void own()
+	{
+		if (!m_mapped)
+			return;
+		m_owned.assign(m_data, m_data + m_size);
+		m_mapped = false;
+	}
+
+public:
+	MeshArray() {}
+	MeshArray(const MeshArray& other) { *this = other; }
+	MeshArray& operator=(const MeshArray& other)
+	{
+		if (this == &other)
+			return *this;
+		m_owned = other.m_owned;
+		m_mapped = other.m_mapped;
+		if (m_mapped)
+		{
+			m_data = other.m_data;
+			m_size = other.m_size;
+		}
+		else
+			sync();
+		return *this;
+	}
+
+	// views count elements at data, which must outlive the array or its next resize
+	void map(const void* data, size_t count)
+	{
+		std::vector<T>().swap(m_owned);
+		m_data = (T*)data;
+		m_size = count;
+		m_mapped = true;
+	}
+	bool isMapped() const { return m_mapped; }
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	T* data() { return m_data; }
+	const T* data() const { return m_data; }
+	T* begin() { return m_data; }
+	T* end() { return m_data + m_size; }
+	const T* begin() const { return m_data; }
+	const T* end() const { return m_data + m_size; }
+	T& operator[](size_t i) { return m_data[i]; }
+	const T& operator[](size_t i) const { return m_data[i]; }
+
+	void push_back(const T& value) { own(); m_owned.push_back(value); sync(); }
+	void reserve(size_t count) { own(); m_owned.reserve(count); sync(); }
+	void resize(size_t count) { own(); m_owned.resize(count); sync(); }
+	void resize(size_t count, const T& value) { own(); m_owned.resize(count, value); sync(); }
+	template <typename It>
+	void assign(It first, It last) { m_mapped = false; m_owned.assign(first, last); sync(); }
+	void shrink_to_fit() { if (!m_mapped) { m_owned.shrink_to_fit(); sync(); } }
+	// releases the memory
+	void clear() { m_mapped = false; std::vector<T>().swap(m_owned); sync(); }
+	void swap(MeshArray& other)
+	{
+		m_owned.swap(other.m_owned);
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+		std::swap(m_mapped, other.m_mapped);
+	}
+	bool operator==(const MeshArray& other) const
+	{
+		if (m_size != other.m_size)
+			return false;
+		for (size_t i = 0; i < m_size; i++)
+			if (!(m_data[i] == other.m_data[i]))
+				return false;
+		return true;
+	}
+};
@@ -0,0 +1,66 @@
+#include "Quantization.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+void QuantizedPositions::build(const glm::vec3* positions, size_t count, int bits)
+{
+	clear();
+	m_bits = bits <= 16 ? 16 : 21;
+	m_size = count;
+	float levels = m_bits == 16 ? 65535.0f : 2097151.0f;
+	long long num_clusters = (long long)((count + QUANTIZE_CLUSTER_SIZE - 1) / QUANTIZE_CLUSTER_SIZE);
+	m_clusters.resize(num_clusters);
+	if (m_bits == 16)
+		m_positions16.resize(3 * count);
+	else
+		m_positions21.resize(count);
+
+#pragma omp parallel for
+	for (long long c = 0; c < num_clusters; c++)
+	{
+		size_t first = (size_t)c * QUANTIZE_CLUSTER_SIZE;
+		size_t last = std::min(first + QUANTIZE_CLUSTER_SIZE, count);
+		glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+		for (size_t i = first; i < last; i++)
+		{
+			bmin = glm::min(bmin, positions[i]);
+			bmax = glm::max(bmax, positions[i]);
+		}
+		Cluster& cluster = m_clusters[c];
+		cluster.m_min = bmin;
+		cluster.m_step = (bmax - bmin) / levels;
+		// flat clusters quantize their flat axes to 0
+		glm::vec3 scale = glm::vec3(levels) / glm::max(bmax - bmin, glm::vec3(FLT_MIN));
+		for (size_t i = first; i < last; i++)
+		{
+			glm::vec3 q = glm::clamp(glm::round((positions[i] - bmin) * scale), glm::vec3(0.0f), glm::vec3(levels));
+			if (m_bits == 16)
+			{
+				m_positions16[3 * i + 0] = (uint16_t)q.x;
+				m_positions16[3 * i + 1] = (uint16_t)q.y;
+				m_positions16[3 * i + 2] = (uint16_t)q.z;
+			}
+			else
+				m_positions21[i] = (uint64_t)q.x | ((uint64_t)q.y << 21) | ((uint64_t)q.z << 42);
+		}
+	}
+}
+
+void QuantizedPositions::clear()
+{
+	std::vector<Cluster>().swap(m_clusters);
+	std::vector<uint16_t>().swap(m_positions16);
+	std::vector<uint64_t>().swap(m_positions21);
+	m_bits = 0;
+	m_size = 0;
+}
+
+void OctahedralNormals::build(const glm::vec3* normals, size_t count)
+{
+	m_normals.resize(count);
+	long long n = (long long)count;
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++)
+		m_normals[i] = encodeOctahedral(normals[i]);
+}
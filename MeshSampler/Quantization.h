@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Compact in-memory vertex attributes, decoded on access.
+
+// consecutive vertices sharing the bounds of their quantized positions
+#define QUANTIZE_CLUSTER_SIZE 256
+
+// Positions quantized to 16 or 21 bits per axis, relative to the bounds of clusters of consecutive
+// vertices, so that the precision follows the local extent of the mesh instead of its bounding
+// box. Vertices renumbered along a space-filling curve (Mesh::reorder) give tight clusters.
+class QuantizedPositions
+{
+	struct Cluster
+	{
+		glm::vec3 m_min;
+		glm::vec3 m_step; // extent of the cluster divided by the quantization levels
+	};
+
+	std::vector<Cluster> m_clusters;
+	std::vector<uint16_t> m_positions16; // 3 per vertex
+	std::vector<uint64_t> m_positions21; // 21 bits per axis, x in the low bits
+	int m_bits = 0;
+	size_t m_size = 0;
+
+public:
+	// quantizes count positions, to 16 bits per axis if bits <= 16 and to 21 bits otherwise
+	void build(const glm::vec3* positions, size_t count, int bits);
+	void clear();
+
+	int getBits() const { return m_bits; }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	size_t bytes() const
+	{
+		return m_clusters.size() * sizeof(Cluster) + m_positions16.size() * sizeof(uint16_t) + m_positions21.size() * sizeof(uint64_t);
+	}
+
+	glm::vec3 operator[](size_t i) const
+	{
+		const Cluster& cluster = m_clusters[i / QUANTIZE_CLUSTER_SIZE];
+		glm::vec3 q;
+		if (m_bits == 16)
+			q = glm::vec3(m_positions16[3 * i + 0], m_positions16[3 * i + 1], m_positions16[3 * i + 2]);
+		else
+		{
+			uint64_t p = m_positions21[i];
+			q = glm::vec3((float)(p & 0x1fffff), (float)((p >> 21) & 0x1fffff), (float)((p >> 42) & 0x1fffff));
+		}
+		return cluster.m_min + q * cluster.m_step;
+	}
+};
+
+// unit vector folded onto an octahedron and unfolded to a square, in 2x16 bits [Meyer et al. 2010]
+inline uint32_t encodeOctahedral(glm::vec3 n)
+{
+	float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (!(sum > 0.0f))
+		return encodeOctahedral(glm::vec3(0.0f, 0.0f, 1.0f));
+	n /= sum;
+	glm::vec2 p(n.x, n.y);
+	if (n.z < 0.0f)
+		p = glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	int16_t x = (int16_t)roundf(glm::clamp(p.x, -1.0f, 1.0f) * 32767.0f);
+	int16_t y = (int16_t)roundf(glm::clamp(p.y, -1.0f, 1.0f) * 32767.0f);
+	return (uint32_t)(uint16_t)x | ((uint32_t)(uint16_t)y << 16);
+}
+
+inline glm::vec3 decodeOctahedral(uint32_t e)
+{
+	glm::vec3 n((int16_t)(e & 0xffff) / 32767.0f, (int16_t)(e >> 16) / 32767.0f, 0.0f);
+	n.z = 1.0f - fabsf(n.x) - fabsf(n.y);
+	if (n.z < 0.0f)
+	{
+		float x = n.x;
+		n.x = (1.0f - fabsf(n.y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - fabsf(x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return glm::normalize(n);
+}
+
+// unit vectors in 32 bits each, as octahedral coordinates
+class OctahedralNormals
+{
+	std::vector<uint32_t> m_normals;
+
+public:
+	void build(const glm::vec3* normals, size_t count);
+	void clear() { std::vector<uint32_t>().swap(m_normals); }
+
+	size_t size() const { return m_normals.size(); }
+	bool empty() const { return m_normals.empty(); }
+	size_t bytes() const { return m_normals.size() * sizeof(uint32_t); }
+
+	glm::vec3 operator[](size_t i) const { return decodeOctahedral(m_normals[i]); }
+};
@@ -0,0 +1,137 @@
+#include "TextureCache.h"
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+static std::atomic<uint64_t> s_next_epoch(1);
+
+TextureCache::TextureCache()
+{
+	m_epoch = s_next_epoch++;
+}
+
+TextureCache::~TextureCache()
+{
+	clear();
+}
+
+int TextureCache::open(const std::string& filename, size_t page_bytes)
+{
+	FILE* file;
+	if (fopen_s(&file, filename.c_str(), "rb") != 0)
+		return -1;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	File f;
+	f.m_file = file;
+	f.m_page_bytes = page_bytes;
+	f.m_io = std::make_shared<std::mutex>();
+	m_files.push_back(f);
+	return (int)m_files.size() - 1;
+}
+
+TextureCache::PageData TextureCache::fault(int file, size_t page)
+{
+	uint64_t key = ((uint64_t)file << 40) | page;
+	File f;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_pages.find(key);
+		if (iter != m_pages.end())
+		{
+			m_hits++;
+			m_lru.splice(m_lru.begin(), m_lru, iter->second.m_lru);
+			return iter->second.m_data;
+		}
+		m_misses++;
+		f = m_files[file];
+	}
+
+	// the page is read without holding the cache lock; threads faulting the same page at once
+	// read it each, the first one inserted is kept
+	std::shared_ptr<std::vector<unsigned char>> data = std::make_shared<std::vector<unsigned char>>(f.m_page_bytes);
+	{
+		std::lock_guard<std::mutex> io(*f.m_io);
+		if (_fseeki64(f.m_file, (long long)(sizeof(TiledTextureHeader) + page * f.m_page_bytes), SEEK_SET) != 0 ||
+			fread(data->data(), 1, f.m_page_bytes, f.m_file) != f.m_page_bytes)
+			return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_pages.find(key);
+	if (iter != m_pages.end())
+		return iter->second.m_data;
+	while (!m_lru.empty() && m_used + f.m_page_bytes > m_budget)
+	{
+		auto victim = m_pages.find(m_lru.back());
+		m_used -= victim->second.m_data->size();
+		m_pages.erase(victim);
+		m_lru.pop_back();
+		m_evictions++;
+	}
+	m_lru.push_front(key);
+	Page& p = m_pages[key];
+	p.m_data = data;
+	p.m_lru = m_lru.begin();
+	m_used += f.m_page_bytes;
+	m_peak = std::max(m_peak, m_used);
+	return p.m_data;
+}
+
+bool TextureCache::read(int file, size_t offset, unsigned char* out, int count)
+{
+	struct LastPage
+	{
+		uint64_t m_epoch = 0;
+		int m_file = -1;
+		size_t m_page = 0;
+		size_t m_page_bytes = 0;
+		PageData m_data;
+	};
+	static thread_local LastPage last;
+
+	if (last.m_epoch != m_epoch || last.m_file != file || last.m_page != offset / last.m_page_bytes)
+	{
+		size_t page_bytes;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			page_bytes = m_files[file].m_page_bytes;
+		}
+		PageData data = fault(file, offset / page_bytes);
+		if (!data)
+		{
+			memset(out, 0, count);
+			return false;
+		}
+		last.m_epoch = m_epoch;
+		last.m_file = file;
+		last.m_page = offset / page_bytes;
+		last.m_page_bytes = page_bytes;
+		last.m_data = std::move(data);
+	}
+	memcpy(out, &(*last.m_data)[offset % last.m_page_bytes], count);
+	return true;
+}
+
+void TextureCache::printStatistics()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_files.empty())
+		return;
+	size_t lookups = m_hits + m_misses;
+	printf("Texture cache: %zu hits, %zu misses (%.1f%% hit rate), %zu evictions, peak %.1f of %.1f Mbytes\n",
+		m_hits, m_misses, lookups ? 100.0 * m_hits / lookups : 0.0, m_evictions,
+		m_peak / (1024.0 * 1024.0), m_budget / (1024.0 * 1024.0));
+}
+
+void TextureCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto& f : m_files)
+		fclose(f.m_file);
+	m_files.clear();
+	m_pages.clear();
+	m_lru.clear();
+	m_used = 0;
+	m_epoch = s_next_epoch++;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define TILED_TEXTURE_VERSION 2
+
+// Header of the tiled texture files (".mstx"). The header is followed by the texel data of all
+// mip levels, exactly as laid out in memory by Texture, so that pages map to contiguous file ranges
+// and whole files can be memory mapped. The source image fields identify stale files.
+struct TiledTextureHeader
+{
+	char m_magic[4] = { 'M', 'S', 'T', 'X' };
+	uint32_t m_version = TILED_TEXTURE_VERSION;
+	int32_t m_width = 0;
+	int32_t m_height = 0;
+	int32_t m_channels = 0;
+	int32_t m_format = 0;
+	uint64_t m_data_size = 0;
+	uint64_t m_source_size = 0;  // size, modification time and path hash of the source image
+	uint64_t m_source_time = 0;
+	uint64_t m_source_hash = 0;
+};
+
+// Pages of tiled texture files faulted in on demand, under a memory budget. The least recently
+// used pages are evicted when the budget is exceeded. All the methods are thread safe.
+// Each thread keeps a reference to the last page it read, so that the texels of a lookup footprint
+// are read without locking; an evicted page stays valid until its readers move on, so the budget
+// can be exceeded by a page per thread.
+class TextureCache
+{
+	typedef std::shared_ptr<const std::vector<unsigned char>> PageData;
+
+	struct Page
+	{
+		PageData m_data;
+		std::list<uint64_t>::iterator m_lru;
+	};
+
+	struct File
+	{
+		FILE* m_file = nullptr;
+		size_t m_page_bytes = 0;
+		std::shared_ptr<std::mutex> m_io; // serializes the reads of the file, outside the cache lock
+	};
+
+	std::vector<File> m_files;
+	std::unordered_map<uint64_t, Page> m_pages; // key: file id and page index
+	std::list<uint64_t> m_lru;                  // most recently used first
+	size_t m_budget = 0;
+	size_t m_used = 0;
+	size_t m_peak = 0;
+	size_t m_hits = 0;
+	size_t m_misses = 0;
+	size_t m_evictions = 0;
+	uint64_t m_epoch = 0; // changes when the files are closed, invalidating the pages of the threads
+	std::mutex m_mutex;
+
+	PageData fault(int file, size_t page);
+
+public:
+	TextureCache();
+	~TextureCache();
+
+	void setBudget(size_t bytes) { m_budget = bytes; }
+	size_t getBudget() const { return m_budget; }
+
+	// opens a tiled texture file for paging, returns its id or -1
+	int open(const std::string& filename, size_t page_bytes);
+	// copies count bytes at offset of the texture data; the range must not cross a page. Hits of
+	// the last page of the thread are not counted in the statistics.
+	bool read(int file, size_t offset, unsigned char* out, int count);
+
+	void printStatistics();
+	void clear();
+};
@@ -2,16 +2,146 @@
 #include <algorithm>
 #include <SDL2/SDL_image.h>
 #include <iostream>
+#include <climits>
+#include <filesystem>
 #include "sampling.h"
+#include "BlockCompression.h"
+#include "util.h"
+#include <xmmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+std::atomic<uint32_t> Texture::s_next_uid { 0 };
 
 // Texture
 TextureManager::TextureManager()
 {
+	// load the image decoders here, on the main thread, since the loader threads call IMG_Load
+	IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG | IMG_INIT_TIF);
+}
+
+static uint64_t hashString(const std::string& str)
+{
+	return hashBytes(str.data(), str.size());
+}
+
+void TextureManager::setCacheDirectory(std::string dir)
+{
+	m_cache_dir = dir;
+	if (m_cache_dir.empty())
+		return;
+	std::error_code error;
+	std::filesystem::create_directories(m_cache_dir, error);
+	if (m_cache_dir.back() != '/' && m_cache_dir.back() != '\\')
+		m_cache_dir += '/';
+}
+
+std::string TextureManager::getCachedFilename(const std::string& name) const
+{
+	if (!m_cache_dir.empty())
+	{
+		char hash[32];
+		snprintf(hash, sizeof(hash), "%016llx_", (unsigned long long)hashString(name));
+		return m_cache_dir + hash + std::filesystem::path(name).filename().string() + ".mstx";
+	}
+	// paged textures need their tiled file anyway
+	if (m_cache.getBudget() > 0)
+		return name + ".mstx";
+	return "";
+}
+
+Texture* TextureManager::loadCachedTexture(const std::string& name, const std::string& cached, const TiledTextureHeader& source)
+{
+	FILE* file;
+	if (fopen_s(&file, cached.c_str(), "rb") != 0)
+		return nullptr;
+	TiledTextureHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1;
+	fclose(file);
+	if (!ok || memcmp(header.m_magic, source.m_magic, 4) != 0 || header.m_version != TILED_TEXTURE_VERSION ||
+		header.m_source_size != source.m_source_size || header.m_source_time != source.m_source_time ||
+		header.m_source_hash != source.m_source_hash)
+		return nullptr;
+
+	Texture* tex = new Texture();
+	tex->m_name = name;
+	tex->m_format = header.m_format;
+	if (tex->layout(header.m_width, header.m_height, header.m_channels) != header.m_data_size ||
+		!(m_cache.getBudget() > 0 ? tex->page(&m_cache, cached) : tex->map(cached)))
+	{
+		delete tex;
+		return nullptr;
+	}
+	return tex;
+}
+
+Texture* TextureManager::loadCompressedTexture(const std::string& name)
+{
+	CompressedImage image;
+	if (!readCompressedImage(name, image))
+	{
+		printf("Could not Load texture %s\n", name.c_str());
+		return 0;
+	}
 
+	Texture* tex = new Texture();
+	tex->m_name = name;
+	tex->m_format = image.m_format;
+	tex->m_width = image.m_width;
+	tex->m_height = image.m_height;
+	tex->m_channels = 4;
+	int width = image.m_width, height = image.m_height;
+	for (size_t offset : image.m_levels)
+	{
+		TextureLevel level;
+		level.m_width = width;
+		level.m_height = height;
+		level.m_pow2 = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+		level.m_blocks_x = (width + TEX_BLOCK_SIZE - 1) / TEX_BLOCK_SIZE;
+		level.m_offset = offset;
+		tex->m_levels.push_back(level);
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	tex->m_data_size = image.m_data.size();
+	tex->m_data = std::move(image.m_data);
+	tex->m_data.resize(tex->m_data_size + TEX_DATA_PADDING, 0);
+	tex->m_texels = tex->m_data.data();
+	return tex;
 }
 
-Texture* TextureManager::loadTexture(std::string name)
+Texture* TextureManager::loadTexture(std::string name, bool parallel)
 {
+	// block-compressed textures stay compressed, they are neither tiled nor paged
+	if (isCompressedImageFile(name))
+		return loadCompressedTexture(name);
+
+	// a tiled file of the same source image skips the decoding
+	std::string cached = getCachedFilename(name);
+	TiledTextureHeader source;
+	if (!cached.empty())
+	{
+		std::error_code error;
+		source.m_source_size = (uint64_t)std::filesystem::file_size(name, error);
+		source.m_source_time = (uint64_t)std::filesystem::last_write_time(name, error).time_since_epoch().count();
+		source.m_source_hash = hashString(name);
+		if (error)
+			cached.clear();
+	}
+	if (!cached.empty())
+	{
+		Texture* tex = loadCachedTexture(name, cached, source);
+		if (tex)
+			return tex;
+	}
+
+	// a decoded texture and its mipmaps are in memory until they are written and paged, so with
+	// a budget the loaders decode one texture at a time instead of one each
+	std::unique_lock<std::mutex> decode(m_decode_mutex, std::defer_lock);
+	if (m_cache.getBudget() > 0)
+		decode.lock();
+
 	SDL_Surface* surf = IMG_Load(name.c_str());
 	if (surf == 0)
 	{
@@ -36,64 +166,86 @@ Texture* TextureManager::loadTexture(std::string name)
 
 	default:
 		printf("Error in number of colors in %s\n", name.c_str());
-	}
-
-	unsigned char* data = new unsigned char[surf->w * surf->h * surf->format->BytesPerPixel];
-
-	tex->m_width = surf->w;
-	tex->m_height = surf->h;
-	
-	// flip image
-	for (int y = 0; y < surf->h; y++)
-	{
-		memcpy(
-			&data[(surf->h - y - 1) * surf->w * surf->format->BytesPerPixel],
-			&static_cast<unsigned char*>(surf->pixels)[y * surf->w * surf->format->BytesPerPixel],
-			surf->w * surf->format->BytesPerPixel * sizeof(unsigned char));
+		SDL_FreeSurface(surf);
+		delete tex;
+		return 0;
 	}
 
 	int num_channels = surf->format->BytesPerPixel;
-	tex->m_channels = num_channels;
 
+	// flip and tile the image, keeping the native 8-bit texels
+	tex->allocate(surf->w, surf->h, num_channels);
 	SDL_LockSurface(surf);
-	tex->m_data.resize(surf->w * surf->h * num_channels);
-	for (size_t k = 0; k < surf->w * surf->h; k++)
+	for (int y = 0; y < surf->h; y++)
 	{
-		switch (tex->m_format)
+		const unsigned char* row = &static_cast<unsigned char*>(surf->pixels)[(size_t)(surf->h - y - 1) * surf->pitch];
+		for (int x = 0; x < surf->w; x += TEX_TILE_SIZE)
 		{
-		case TEXFORMAT_RGB:
-			tex->m_data[k * num_channels + 0] = data[k * num_channels + 0] / 255.0f;
-			tex->m_data[k * num_channels + 1] = data[k * num_channels + 1] / 255.0f;
-			tex->m_data[k * num_channels + 2] = data[k * num_channels + 2] / 255.0f;
-			break;
-		case TEXFORMAT_BGR:
-			tex->m_data[k * num_channels + 0] = data[k * num_channels + 2] / 255.0f;
-			tex->m_data[k * num_channels + 1] = data[k * num_channels + 1] / 255.0f;
-			tex->m_data[k * num_channels + 2] = data[k * num_channels + 0] / 255.0f;
-			break;
-		case TEXFORMAT_RGBA:
-			tex->m_data[k * num_channels + 0] = data[k * num_channels + 0] / 255.0f;
-			tex->m_data[k * num_channels + 1] = data[k * num_channels + 1] / 255.0f;
-			tex->m_data[k * num_channels + 2] = data[k * num_channels + 2] / 255.0f;
-			tex->m_data[k * num_channels + 3] = data[k * num_channels + 3] / 255.0f;
-		case TEXFORMAT_BGRA:
-			tex->m_data[k * num_channels + 0] = data[k * num_channels + 2] / 255.0f;
-			tex->m_data[k * num_channels + 1] = data[k * num_channels + 1] / 255.0f;
-			tex->m_data[k * num_channels + 2] = data[k * num_channels + 0] / 255.0f;
-			tex->m_data[k * num_channels + 3] = data[k * num_channels + 3] / 255.0f;
-			break;
+			// contiguous run of texels within a tile row
+			int run = std::min(TEX_TILE_SIZE, surf->w - x);
+			memcpy(&tex->m_data[tex->texelOffset(x, y)], &row[x * num_channels], run * num_channels);
 		}
 	}
 	SDL_UnlockSurface(surf);
 
-	delete[] data;
-	
+	// store all textures in RGB(A) order
+	if (tex->m_format == TEXFORMAT_BGR || tex->m_format == TEXFORMAT_BGRA)
+	{
+		size_t base_size = tex->m_levels.size() > 1 ? tex->m_levels[1].m_offset : tex->m_data_size;
+		for (size_t k = 0; k < base_size; k += num_channels)
+			std::swap(tex->m_data[k + 0], tex->m_data[k + 2]);
+		tex->m_format = tex->m_format == TEXFORMAT_BGR ? TEXFORMAT_RGB : TEXFORMAT_RGBA;
+	}
+	tex->buildMipmaps(parallel);
+
 	if (surf) SDL_FreeSurface(surf);
+
+	if (!cached.empty())
+	{
+		if (!tex->write(cached, source))
+			printf("Could not write tiled texture %s, keeping %s in memory\n", cached.c_str(), name.c_str());
+		// beyond the memory budget, page the texels from the tiled file
+		else if (m_cache.getBudget() > 0 && !tex->page(&m_cache, cached))
+			printf("Could not open tiled texture %s, keeping %s in memory\n", cached.c_str(), name.c_str());
+	}
 	return tex;
 }
 
+void TextureManager::loaderThread()
+{
+	while (true)
+	{
+		std::pair<int, std::string> job;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_queue.empty())
+			{
+				m_active_loaders--;
+				return;
+			}
+			job = m_queue.front();
+			m_queue.pop_front();
+		}
+		// the loaders already run in parallel, one texture each
+		Texture* tex = loadTexture(job.second, false);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_textures[job.first] = tex;
+	}
+}
+
+void TextureManager::wait()
+{
+	if (!m_loading)
+		return;
+	for (auto& t : m_loaders)
+		t.join();
+	m_loaders.clear();
+	m_loading = false;
+}
+
 Texture* TextureManager::getTexture(int id)
 {
+	wait();
 	if (id < m_textures.size() && id >= 0)
 		return m_textures[id];
 	else
@@ -110,22 +262,39 @@ int TextureManager::getTextureID(std::string name)
 	auto iter = m_texture_index.find(name);
 	if (iter != m_texture_index.end())
 		return iter->second;
-	Texture* tex = loadTexture(name);
-	if (!tex)
-		return -1;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
 	int id = (int)m_textures.size();
 	m_texture_index[name] = id;
-	m_textures.push_back(tex);
+	m_textures.push_back(nullptr);
+	m_queue.push_back(std::make_pair(id, name));
+	// up to one loader per hardware thread; exited loaders are joined in wait()
+	if (m_active_loaders < (int)std::max(1u, std::thread::hardware_concurrency()))
+	{
+		m_active_loaders++;
+		m_loading = true;
+		m_loaders.emplace_back(&TextureManager::loaderThread, this);
+	}
 	return id;
 }
 
-glm::vec4 TextureManager::sampleTexture(int id, float u, float v)
+glm::vec4 TextureManager::sampleTexture(int id, float u, float v, float footprint)
 {
-	if (id >= 0 && id < m_textures.size())
-		return m_textures[id]->sample(m_sampling, u, v);
+	wait();
+	if (id >= 0 && id < m_textures.size() && m_textures[id])
+		return m_textures[id]->sample(m_sampling, u, v, footprint);
 	return glm::vec4(1.0f);
 }
 
+void TextureManager::sampleTexture(int id, const float* u, const float* v, glm::vec4* colors, size_t count, float footprint)
+{
+	wait();
+	if (id >= 0 && id < m_textures.size() && m_textures[id])
+		m_textures[id]->sample(m_sampling, u, v, colors, count, footprint);
+	else
+		std::fill(colors, colors + count, glm::vec4(1.0f));
+}
+
 TextureManager::~TextureManager()
 {
 	clear();
@@ -133,80 +302,362 @@ TextureManager::~TextureManager()
 
 void TextureManager::clear()
 {
+	wait();
 	for (auto t : m_textures)
 		delete t;
 	m_textures.clear();
 	m_texture_index.clear();
+	m_cache.clear();
+}
+
+size_t Texture::layout(int width, int height, int channels)
+{
+	m_width = width;
+	m_height = height;
+	m_channels = channels;
+	m_levels.clear();
+	size_t size = 0;
+	while (true)
+	{
+		TextureLevel level;
+		level.m_width = width;
+		level.m_height = height;
+		level.m_pow2 = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+		level.m_pages_x = (width + TEX_PAGE_MASK) >> TEX_PAGE_SHIFT;
+		level.m_offset = size;
+		int pages_y = (height + TEX_PAGE_MASK) >> TEX_PAGE_SHIFT;
+		size += (size_t)level.m_pages_x * pages_y * TEX_PAGE_TEXELS * channels;
+		m_levels.push_back(level);
+		if (width == 1 && height == 1)
+			break;
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	m_data_size = size;
+	return size;
+}
+
+void Texture::allocate(int width, int height, int channels)
+{
+	m_data.assign(layout(width, height, channels) + TEX_DATA_PADDING, 0);
+	m_texels = m_data.data();
+}
+
+bool Texture::write(const std::string& filename, TiledTextureHeader header) const
+{
+	FILE* file;
+	if (fopen_s(&file, filename.c_str(), "wb") != 0)
+		return false;
+	header.m_width = m_width;
+	header.m_height = m_height;
+	header.m_channels = m_channels;
+	header.m_format = m_format;
+	header.m_data_size = m_data_size;
+	// the padding is stored too, for the gathers from mapped files
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(m_texels, 1, m_data_size + TEX_DATA_PADDING, file) == m_data_size + TEX_DATA_PADDING;
+	ok = (fclose(file) == 0) && ok;
+	if (!ok)
+		remove(filename.c_str());
+	return ok;
+}
+
+bool Texture::page(TextureCache* cache, const std::string& filename)
+{
+	m_cache_file = cache->open(filename, (size_t)TEX_PAGE_TEXELS * m_channels);
+	if (m_cache_file < 0)
+		return false;
+	m_cache = cache;
+	m_texels = nullptr;
+	std::vector<unsigned char>().swap(m_data);
+	return true;
+}
+
+bool Texture::map(const std::string& filename)
+{
+	if (!m_mapping.open(filename) || m_mapping.size() < sizeof(TiledTextureHeader) + m_data_size + TEX_DATA_PADDING)
+		return false;
+	m_texels = m_mapping.data() + sizeof(TiledTextureHeader);
+	std::vector<unsigned char>().swap(m_data);
+	return true;
+}
+
+void Texture::buildMipmaps(bool parallel)
+{
+	// 2x2 box filter of the previous level
+	for (size_t l = 1; l < m_levels.size(); l++)
+	{
+		const TextureLevel& src = m_levels[l - 1];
+		const TextureLevel& dst = m_levels[l];
+#pragma omp parallel for if (parallel)
+		for (int y = 0; y < dst.m_height; y++)
+		{
+			int y0 = std::min(2 * y, src.m_height - 1), y1 = std::min(2 * y + 1, src.m_height - 1);
+			for (int x = 0; x < dst.m_width; x++)
+			{
+				int x0 = std::min(2 * x, src.m_width - 1), x1 = std::min(2 * x + 1, src.m_width - 1);
+				const unsigned char* t00 = &m_data[src.texelOffset(x0, y0, m_channels)];
+				const unsigned char* t01 = &m_data[src.texelOffset(x1, y0, m_channels)];
+				const unsigned char* t10 = &m_data[src.texelOffset(x0, y1, m_channels)];
+				const unsigned char* t11 = &m_data[src.texelOffset(x1, y1, m_channels)];
+				unsigned char* t = &m_data[dst.texelOffset(x, y, m_channels)];
+				for (int c = 0; c < m_channels; c++)
+					t[c] = (unsigned char)((t00[c] + t01[c] + t10[c] + t11[c] + 2) / 4);
+			}
+		}
+	}
+}
+
+// pointer to the texel at offset, for paged textures copied from the cache to paged
+const unsigned char* Texture::texel(size_t offset, unsigned char* paged) const
+{
+	if (!m_cache)
+		return &m_texels[offset];
+	m_cache->read(m_cache_file, offset, paged, m_channels);
+	return paged;
+}
+
+// pointer to the RGBA texel (x, y) of a compressed texture, through the decoded blocks of the thread
+const unsigned char* Texture::blockTexel(const TextureLevel& level, int x, int y) const
+{
+	struct DecodedBlock
+	{
+		uint64_t m_key = UINT64_MAX;
+		unsigned char m_rgba[TEX_BLOCK_SIZE * TEX_BLOCK_SIZE * 4];
+	};
+	thread_local DecodedBlock blocks[1 << (2 * TEX_BLOCK_CACHE_SHIFT)];
+
+	// blocks are stored top row first
+	y = level.m_height - 1 - y;
+	int bx = x / TEX_BLOCK_SIZE, by = y / TEX_BLOCK_SIZE;
+	size_t offset = level.m_offset + ((size_t)by * level.m_blocks_x + bx) * blockBytes(m_format);
+	uint64_t key = ((uint64_t)m_uid << 40) | offset;
+	// neighbouring blocks map to distinct entries; textures and levels are spread by a hash
+	uint32_t salt = (m_uid * 0x9E3779B1u) ^ ((uint32_t)level.m_offset * 0x85EBCA6Bu);
+	int slot = (((by & TEX_BLOCK_CACHE_MASK) << TEX_BLOCK_CACHE_SHIFT) | (bx & TEX_BLOCK_CACHE_MASK)) ^ (salt >> (32 - 2 * TEX_BLOCK_CACHE_SHIFT));
+	DecodedBlock& decoded = blocks[slot];
+	if (decoded.m_key != key)
+	{
+		decodeBlock(m_format, &m_texels[offset], decoded.m_rgba);
+		decoded.m_key = key;
+	}
+	return &decoded.m_rgba[((y % TEX_BLOCK_SIZE) * TEX_BLOCK_SIZE + x % TEX_BLOCK_SIZE) * 4];
+}
+
+template <bool POW2>
+glm::vec4 Texture::fetch(const TextureLevel& level, int x, int y) const
+{
+	if (POW2)
+	{
+		x &= level.m_width - 1;
+		y &= level.m_height - 1;
+	}
+	else
+	{
+		x = (level.m_width + x % level.m_width) % level.m_width;
+		y = (level.m_height + y % level.m_height) % level.m_height;
+	}
+	unsigned char paged[4];
+	const unsigned char* texel = isCompressed() ? blockTexel(level, x, y) : this->texel(level.texelOffset(x, y, m_channels), paged);
+	glm::vec4 color = glm::vec4(texel[0], texel[1], texel[2], m_channels == 4 ? texel[3] : 255);
+	return color * (1.0f / 255.0f);
+}
+
+template <bool POW2>
+glm::vec4 Texture::sampleBilinear(const TextureLevel& level, float x, float y, bool sharp) const
+{
+	float low[2];
+	low[0] = floor(x);
+	low[1] = floor(y);
+	int ix = (int)low[0], iy = (int)low[1];
+	glm::vec4 ll = fetch<POW2>(level, ix, iy);
+	glm::vec4 lh = fetch<POW2>(level, ix, iy + 1);
+	glm::vec4 hl = fetch<POW2>(level, ix + 1, iy);
+	glm::vec4 hh = fetch<POW2>(level, ix + 1, iy + 1);
+	glm::vec4 top, bottom;
+	if (sharp)
+	{
+		top = COSERP(lh, hh, (x - low[0]));
+		bottom = COSERP(ll, hl, (x - low[0]));
+		return COSERP(bottom, top, (y - low[1]));
+	}
+	else
+	{
+		top = LERP(lh, hh, (x - low[0]));
+		bottom = LERP(ll, hl, (x - low[0]));
+		return LERP(bottom, top, (y - low[1]));
+	}
+}
+
+glm::vec4 Texture::sampleLevel(int l, float u, float v) const
+{
+	const TextureLevel& level = m_levels[l];
+	float x = u * (level.m_width - 1);
+	float y = v * (level.m_height - 1);
+	if (level.m_pow2)
+		return sampleBilinear<true>(level, x, y, false);
+	else
+		return sampleBilinear<false>(level, x, y, false);
 }
 
-glm::vec4 Texture::sample(int mode, float u, float v)
+glm::vec4 Texture::sample(int mode, float u, float v, float footprint)
 {
+	const TextureLevel& base = m_levels[0];
 	float x = u * (m_width - 1);
 	float y = v * (m_height - 1);
-	glm::vec4 color;
-
-	float low[2], high[2];
-	glm::vec4 ll, lh, hl, hh, top, bottom;
+	float lod;
+	int l;
 
 	switch (mode)
 	{
 	case TEXSAMPLING_LINEAR:
 	case TEXSAMPLING_SHARP:
-		low[0] = floor(x);
-		low[1] = floor(y);
-		high[0] = ceil(x);
-		high[1] = ceil(y);
-		ll = getTexel((int)low[0], (int)low[1]);
-		lh = getTexel((int)low[0], (int)high[1]);
-		hl = getTexel((int)high[0], (int)low[1]);
-		hh = getTexel((int)high[0], (int)high[1]);
-		if (mode == TEXSAMPLING_SHARP)
-		{
-			top = COSERP(lh, hh, (x - low[0]));
-			bottom = COSERP(ll, hl, (x - low[0]));
-			return COSERP(bottom, top, (y - low[1]));
-		}
+		if (base.m_pow2)
+			return sampleBilinear<true>(base, x, y, mode == TEXSAMPLING_SHARP);
 		else
-		{
-			top = LERP(lh, hh, (x - low[0]));
-			bottom = LERP(ll, hl, (x - low[0]));
-			return LERP(bottom, top, (y - low[1]));
-		}
+			return sampleBilinear<false>(base, x, y, mode == TEXSAMPLING_SHARP);
 		break;
 	case TEXSAMPLING_SMOOTH:
-		color = glm::vec4(0);
-		for (int i = 0; i < 16; i++)
-		{
-			float r = 1.414f * sampleUniform0to1();
-			float theta = 2 * PI * sampleUniform0to1();
-			float sx = x + r * cos(theta);
-			float sy = y + r * sin(theta);
-			sx /= m_width;
-			sy /= m_height;
-			color += sample(TEXSAMPLING_LINEAR, sx, sy);
-		}
-		return color / 16.0f;
+		// trilinear lookup in the mip level matching the sample footprint
+		lod = log2f(std::max(footprint * std::max(m_width, m_height), TEX_SMOOTH_MIN_FOOTPRINT));
+		lod = std::min(lod, (float)(m_levels.size() - 1));
+		l = (int)lod;
+		if (l + 1 >= (int)m_levels.size())
+			return sampleLevel(l, u, v);
+		return LERP(sampleLevel(l, u, v), sampleLevel(l + 1, u, v), (lod - l));
 		break;
 	default:
 		return getTexel((int)floor(x + 0.5), (int)floor(y + 0.5));
 	}
+}
 
+#ifdef __AVX2__
+// wraps 8 integer texel coordinates into [0, size)
+static inline __m256i wrap8(__m256i x, int size, bool pow2)
+{
+	__m256i vsize = _mm256_set1_epi32(size);
+	if (pow2)
+		return _mm256_and_si256(x, _mm256_sub_epi32(vsize, _mm256_set1_epi32(1)));
+	// exact for coordinates below 2^24; the division rounding is corrected afterwards
+	__m256 xf = _mm256_cvtepi32_ps(x);
+	__m256 sf = _mm256_cvtepi32_ps(vsize);
+	__m256 q = _mm256_floor_ps(_mm256_div_ps(xf, sf));
+	__m256i r = _mm256_cvtps_epi32(_mm256_sub_ps(xf, _mm256_mul_ps(q, sf)));
+	r = _mm256_add_epi32(r, _mm256_and_si256(vsize, _mm256_cmpgt_epi32(_mm256_setzero_si256(), r)));
+	r = _mm256_sub_epi32(r, _mm256_andnot_si256(_mm256_cmpgt_epi32(vsize, r), vsize));
+	return r;
+}
 
-	return color;
+static inline __m256i texelOffset8(const TextureLevel& level, __m256i x, __m256i y, int channels)
+{
+	__m256i tile_mask = _mm256_set1_epi32(TEX_TILE_MASK);
+	__m256i page_mask = _mm256_set1_epi32(TEX_PAGE_MASK);
+	__m256i page = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(y, TEX_PAGE_SHIFT), _mm256_set1_epi32(level.m_pages_x)),
+		_mm256_srli_epi32(x, TEX_PAGE_SHIFT));
+	__m256i tile = _mm256_or_si256(
+		_mm256_slli_epi32(_mm256_srli_epi32(_mm256_and_si256(y, page_mask), TEX_TILE_SHIFT), TEX_PAGE_SHIFT - TEX_TILE_SHIFT),
+		_mm256_srli_epi32(_mm256_and_si256(x, page_mask), TEX_TILE_SHIFT));
+	__m256i texel = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(y, tile_mask), TEX_TILE_SHIFT), _mm256_and_si256(x, tile_mask));
+	__m256i index = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(page, 2 * TEX_PAGE_SHIFT),
+		_mm256_slli_epi32(tile, 2 * TEX_TILE_SHIFT)), texel);
+	return _mm256_add_epi32(_mm256_mullo_epi32(index, _mm256_set1_epi32(channels)), _mm256_set1_epi32((int)level.m_offset));
 }
 
-glm::vec4 Texture::getTexel(int x, int y)
+// gathers 8 texels (4 bytes each, the 4th byte is ignored for RGB) and converts them to float channels
+static inline void gather8(const unsigned char* data, __m256i offsets, bool alpha, __m256 rgba[4])
 {
-	glm::vec4 color;
-	int indx = (m_width + x % m_width) % m_width;
-	int indy = (m_height + y % m_height) % m_height;
-	
-	color.r = m_data[(indy * m_width + indx) * m_channels + 0];
-	color.g = m_data[(indy * m_width + indx) * m_channels + 1];
-	color.b = m_data[(indy * m_width + indx) * m_channels + 2];
-	if (m_channels == 4)
-		color.a = m_data[(indy * m_width + indx) * m_channels + 4];
-	else
-		color.a = 1.0f;
-	return color;
+	__m256i texels = _mm256_i32gather_epi32((const int*)data, offsets, 1);
+	__m256i byte = _mm256_set1_epi32(0xff);
+	__m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+	rgba[0] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(texels, byte)), scale);
+	rgba[1] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texels, 8), byte)), scale);
+	rgba[2] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texels, 16), byte)), scale);
+	rgba[3] = alpha ? _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(texels, 24)), scale) : _mm256_set1_ps(1.0f);
+}
+
+static inline void store8(const __m256 rgba[4], glm::vec4* colors)
+{
+	alignas(32) float c[4][8];
+	for (int k = 0; k < 4; k++)
+		_mm256_store_ps(c[k], rgba[k]);
+	for (int i = 0; i < 8; i++)
+		colors[i] = glm::vec4(c[0][i], c[1][i], c[2][i], c[3][i]);
+}
+#endif
+
+// loads the cache line of the base level texel nearest to (u, v) ahead of its lookup
+void Texture::prefetch(float u, float v) const
+{
+	const TextureLevel& level = m_levels[0];
+	int x = (int)floor(u * (m_width - 1)), y = (int)floor(v * (m_height - 1));
+	x = (m_width + x % m_width) % m_width;
+	y = (m_height + y % m_height) % m_height;
+	_mm_prefetch((const char*)&m_texels[level.texelOffset(x, y, m_channels)], _MM_HINT_T0);
+}
+
+void Texture::sample(int mode, const float* u, const float* v, glm::vec4* colors, size_t count, float footprint)
+{
+	size_t i = 0;
+	// only the base level lookups of resident, uncompressed textures are worth prefetching
+	bool prefetching = mode != TEXSAMPLING_SMOOTH && !m_cache && !isCompressed();
+#ifdef __AVX2__
+	const TextureLevel& level = m_levels[0];
+	// paged textures go through the cache and compressed ones through the decoded blocks, texel by texel
+	if ((mode == TEXSAMPLING_NEAREST || mode == TEXSAMPLING_LINEAR) && !m_cache && !isCompressed() && m_data_size + TEX_DATA_PADDING < (size_t)INT_MAX)
+	{
+		const unsigned char* data = m_texels;
+		bool alpha = m_channels == 4;
+		__m256 sx = _mm256_set1_ps((float)(m_width - 1));
+		__m256 sy = _mm256_set1_ps((float)(m_height - 1));
+		__m256i one = _mm256_set1_epi32(1);
+		for (; i + 8 <= count; i += 8)
+		{
+			for (size_t k = i + TEX_PREFETCH_DISTANCE; k < std::min(count, i + TEX_PREFETCH_DISTANCE + 8); k++)
+				prefetch(u[k], v[k]);
+			__m256 x = _mm256_mul_ps(_mm256_loadu_ps(u + i), sx);
+			__m256 y = _mm256_mul_ps(_mm256_loadu_ps(v + i), sy);
+			__m256 rgba[4];
+			if (mode == TEXSAMPLING_NEAREST)
+			{
+				__m256 half = _mm256_set1_ps(0.5f);
+				__m256i ix = wrap8(_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(x, half))), level.m_width, level.m_pow2);
+				__m256i iy = wrap8(_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(y, half))), level.m_height, level.m_pow2);
+				gather8(data, texelOffset8(level, ix, iy, m_channels), alpha, rgba);
+			}
+			else
+			{
+				__m256 fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y);
+				__m256 wx = _mm256_sub_ps(x, fx), wy = _mm256_sub_ps(y, fy);
+				__m256i ix = _mm256_cvttps_epi32(fx), iy = _mm256_cvttps_epi32(fy);
+				__m256i x0 = wrap8(ix, level.m_width, level.m_pow2);
+				__m256i x1 = wrap8(_mm256_add_epi32(ix, one), level.m_width, level.m_pow2);
+				__m256i y0 = wrap8(iy, level.m_height, level.m_pow2);
+				__m256i y1 = wrap8(_mm256_add_epi32(iy, one), level.m_height, level.m_pow2);
+				__m256 ll[4], lh[4], hl[4], hh[4];
+				gather8(data, texelOffset8(level, x0, y0, m_channels), alpha, ll);
+				gather8(data, texelOffset8(level, x0, y1, m_channels), alpha, lh);
+				gather8(data, texelOffset8(level, x1, y0, m_channels), alpha, hl);
+				gather8(data, texelOffset8(level, x1, y1, m_channels), alpha, hh);
+				for (int c = 0; c < 4; c++)
+				{
+					__m256 bottom = _mm256_add_ps(ll[c], _mm256_mul_ps(_mm256_sub_ps(hl[c], ll[c]), wx));
+					__m256 top = _mm256_add_ps(lh[c], _mm256_mul_ps(_mm256_sub_ps(hh[c], lh[c]), wx));
+					rgba[c] = _mm256_add_ps(bottom, _mm256_mul_ps(_mm256_sub_ps(top, bottom), wy));
+				}
+			}
+			store8(rgba, colors + i);
+		}
+	}
+#endif
+	for (; i < count; i++)
+	{
+		if (prefetching && i + TEX_PREFETCH_DISTANCE < count)
+			prefetch(u[i + TEX_PREFETCH_DISTANCE], v[i + TEX_PREFETCH_DISTANCE]);
+		colors[i] = sample(mode, u[i], v[i], footprint);
+	}
 }
+
+glm::vec4 Texture::getTexel(int x, int y)
+{
+	return m_levels[0].m_pow2 ? fetch<true>(m_levels[0], x, y) : fetch<false>(m_levels[0], x, y);
+}
\ No newline at end of file
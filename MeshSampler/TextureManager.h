@@ -5,21 +5,110 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include <glm/glm.hpp>
 #include "defs.h"
+#include "TextureCache.h"
+#include "MappedFile.h"
+
+// texels are stored in square tiles of TEX_TILE_SIZE x TEX_TILE_SIZE, so that filter
+// footprints touch as few cache lines and pages as possible
+#define TEX_TILE_SHIFT 3
+#define TEX_TILE_SIZE (1 << TEX_TILE_SHIFT)
+#define TEX_TILE_MASK (TEX_TILE_SIZE - 1)
+
+// tiles are grouped in pages of TEX_PAGE_SIZE x TEX_PAGE_SIZE texels, the unit of paging of
+// textures that do not fit the texture memory budget
+#define TEX_PAGE_SHIFT 5
+#define TEX_PAGE_SIZE (1 << TEX_PAGE_SHIFT)
+#define TEX_PAGE_MASK (TEX_PAGE_SIZE - 1)
+#define TEX_PAGE_TEXELS (TEX_PAGE_SIZE * TEX_PAGE_SIZE)
+
+// bytes after the texel data, so that 32-bit gathers of the last 3-channel texel stay within it
+#define TEX_DATA_PADDING 4
+
+// samples ahead whose texels are prefetched by the batched lookups
+#define TEX_PREFETCH_DISTANCE 8
+
+// decoded blocks of compressed textures kept per thread, direct mapped by the block coordinates
+// within a window of TEX_BLOCK_CACHE_SIZE x TEX_BLOCK_CACHE_SIZE blocks
+#define TEX_BLOCK_CACHE_SHIFT 3
+#define TEX_BLOCK_CACHE_SIZE (1 << TEX_BLOCK_CACHE_SHIFT)
+#define TEX_BLOCK_CACHE_MASK (TEX_BLOCK_CACHE_SIZE - 1)
+
+// minimum footprint, in texels, of the smooth filter
+#define TEX_SMOOTH_MIN_FOOTPRINT 2.0f
+
+struct TextureLevel
+{
+	int m_width = 0;
+	int m_height = 0;
+	int m_pages_x = 0;    // pages per row of pages
+	int m_blocks_x = 0;   // blocks per row of blocks, of compressed textures
+	bool m_pow2 = false;  // power of two dimensions, wrapped with masks instead of modulo
+	size_t m_offset = 0;  // byte offset of the level in the texture data, a multiple of the page size
+
+	// byte offset of texel (x, y) within the level, for coordinates within the level
+	size_t texelOffset(int x, int y, int channels) const
+	{
+		size_t page = (size_t)(y >> TEX_PAGE_SHIFT) * m_pages_x + (x >> TEX_PAGE_SHIFT);
+		size_t tile = (((y & TEX_PAGE_MASK) >> TEX_TILE_SHIFT) << (TEX_PAGE_SHIFT - TEX_TILE_SHIFT)) | ((x & TEX_PAGE_MASK) >> TEX_TILE_SHIFT);
+		size_t texel = ((y & TEX_TILE_MASK) << TEX_TILE_SHIFT) | (x & TEX_TILE_MASK);
+		return m_offset + ((page << (2 * TEX_PAGE_SHIFT)) | (tile << (2 * TEX_TILE_SHIFT)) | texel) * channels;
+	}
+};
 
 struct Texture
 {
 public:
-	std::vector<float> m_data;
+	// 8-bit RGB(A) texels of all mip levels, tiled, bottom row first; empty if paged or mapped.
+	// Compressed textures keep the blocks of the file instead, top row first, decoded on lookup.
+	std::vector<unsigned char> m_data;
+	size_t m_data_size = 0;            // size of the texel data, without padding
+	const unsigned char* m_texels = nullptr; // the texel data of resident textures, in m_data or m_mapping
+	MappedFile m_mapping;
+	std::vector<TextureLevel> m_levels;
 	int m_width;
 	int m_height;
 	int m_channels;
 	int m_format;
 	std::string m_name;
+	TextureCache* m_cache = nullptr;   // source of the texels of paged textures
+	int m_cache_file = -1;
+	uint32_t m_uid = s_next_uid++;     // identifies the blocks of the texture in the decoded block caches
+
+	bool isCompressed() const { return m_format >= TEXFORMAT_BC1; }
+	// computes the layout of the full mip chain, returns the size of the texel data
+	size_t layout(int width, int height, int channels);
+	// allocates the full mip chain; the base level is filled by the caller, then buildMipmaps()
+	void allocate(int width, int height, int channels);
+	void buildMipmaps(bool parallel = true);
+	// writes the texel data to a tiled texture file; the header identifies the source image
+	bool write(const std::string& filename, TiledTextureHeader header) const;
+	// releases the texel data, fetching texels from the pages of the tiled file in the cache from now on
+	bool page(TextureCache* cache, const std::string& filename);
+	// uses the texel data of a tiled file in place, read from the header onwards
+	bool map(const std::string& filename);
+	size_t texelOffset(int x, int y) const { return m_levels[0].texelOffset(x, y, m_channels); }
 
-	glm::vec4 sample(int mode, float u, float v);
+	// footprint: extent of the filter in texture coordinates, used by the smooth filter
+	glm::vec4 sample(int mode, float u, float v, float footprint = 0.0f);
+	// batched lookups; vectorized with AVX2 gathers for the nearest and linear filters
+	void sample(int mode, const float* u, const float* v, glm::vec4* colors, size_t count, float footprint = 0.0f);
 	glm::vec4 getTexel(int x, int y);
+
+protected:
+	const unsigned char* texel(size_t offset, unsigned char* paged) const;
+	const unsigned char* blockTexel(const TextureLevel& level, int x, int y) const;
+	void prefetch(float u, float v) const;
+	template <bool POW2> glm::vec4 fetch(const TextureLevel& level, int x, int y) const;
+	template <bool POW2> glm::vec4 sampleBilinear(const TextureLevel& level, float x, float y, bool sharp) const;
+	glm::vec4 sampleLevel(int level, float u, float v) const;
+
+	static std::atomic<uint32_t> s_next_uid;
 };
 
 
@@ -28,18 +117,45 @@ public:
 class TextureManager
 {
 protected:
-	std::vector<Texture*> m_textures;
+	std::vector<Texture*> m_textures;  // null for textures that failed to load
 	std::unordered_map<std::string, int> m_texture_index;
 	int m_sampling = TEXSAMPLING_LINEAR;
+	TextureCache m_cache;
+	std::string m_cache_dir;
+
+	// textures are decoded asynchronously by a pool of loader threads, joined on first use.
+	// Textures are requested and used from a single thread.
+	std::deque<std::pair<int, std::string>> m_queue;
+	std::vector<std::thread> m_loaders;
+	int m_active_loaders = 0;
+	std::atomic<bool> m_loading { false };
+	std::mutex m_mutex;
+	std::mutex m_decode_mutex;         // held by the decoding loader when paging
 
-	Texture* loadTexture(std::string name);
+	Texture* loadTexture(std::string name, bool parallel = true);
+	// tiled file of a texture, empty if not cached
+	std::string getCachedFilename(const std::string& name) const;
+	// loads a valid tiled file of the source image, paged or memory mapped
+	Texture* loadCachedTexture(const std::string& name, const std::string& cached, const TiledTextureHeader& source);
+	// keeps the blocks of a DDS or KTX file compressed in memory
+	Texture* loadCompressedTexture(const std::string& name);
+	void loaderThread();
+	void wait();
 
 public:
+	// these wait for the pending texture loads
 	Texture* getTexture(int id);
 	Texture* getTexture(std::string name);
+	// queues the texture for loading, if new, and returns its id
 	int getTextureID(std::string name);
-	glm::vec4 sampleTexture(int id, float u, float v);
+	glm::vec4 sampleTexture(int id, float u, float v, float footprint = 0.0f);
+	void sampleTexture(int id, const float* u, const float* v, glm::vec4* colors, size_t count, float footprint = 0.0f);
 	void setSamplingMethod(int method) { m_sampling = method; }
+	// textures loaded afterwards are paged from tiled files, keeping at most mbytes of texels in memory; 0 disables paging
+	void setMemoryBudget(int mbytes) { m_cache.setBudget(1024 * 1024 * (size_t)mbytes); }
+	void printStatistics() { m_cache.printStatistics(); }
+	// keeps decoded textures as tiled files in dir, reused by later runs through memory mapping
+	void setCacheDirectory(std::string dir);
 
 	// get the static instance of Texture Manager
 	static TextureManager& getInstance()
@@ -0,0 +1,139 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cfloat>
+#include <omp.h>
+
+void BVH::build(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax, int leaf_size)
+{
+	clear();
+	if (bmin.empty())
+		return;
+
+	m_leaf_size = std::max(1, leaf_size);
+	long long n = (long long)bmin.size();
+	std::vector<glm::vec3> centroids(n);
+	m_indices.resize(n);
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++)
+	{
+		m_indices[i] = (uint32_t)i;
+		centroids[i] = 0.5f * (bmin[i] + bmax[i]);
+	}
+
+	m_nodes.reserve(2 * (n / m_leaf_size) + 1);
+	buildRecursive(bmin, bmax, centroids, 0, (uint32_t)n, 0);
+	m_nodes.shrink_to_fit();
+}
+
+void BVH::buildRecursive(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax,
+	const std::vector<glm::vec3>& centroids, uint32_t start, uint32_t end, int depth)
+{
+	uint32_t id = (uint32_t)m_nodes.size();
+	m_nodes.push_back(BVHNode());
+
+	glm::vec3 nmin = glm::vec3(FLT_MAX), nmax = glm::vec3(-FLT_MAX);
+	glm::vec3 cmin = glm::vec3(FLT_MAX), cmax = glm::vec3(-FLT_MAX);
+	for (uint32_t i = start; i < end; i++)
+	{
+		uint32_t p = m_indices[i];
+		nmin = glm::min(nmin, bmin[p]);
+		nmax = glm::max(nmax, bmax[p]);
+		cmin = glm::min(cmin, centroids[p]);
+		cmax = glm::max(cmax, centroids[p]);
+	}
+	m_nodes[id].m_min = nmin;
+	m_nodes[id].m_max = nmax;
+
+	uint32_t count = end - start;
+	glm::vec3 extent = cmax - cmin;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+
+	if (count <= (uint32_t)m_leaf_size || depth >= BVH_MAX_DEPTH - 1 || extent[axis] <= 0.0f)
+	{
+		m_nodes[id].m_offset = start;
+		m_nodes[id].m_count = count;
+		return;
+	}
+
+	// binned SAH split along the largest centroid extent
+	struct Bin
+	{
+		glm::vec3 m_min = glm::vec3(FLT_MAX);
+		glm::vec3 m_max = glm::vec3(-FLT_MAX);
+		uint32_t m_count = 0;
+	} bins[BVH_SAH_BINS];
+
+	auto area = [](const glm::vec3& a, const glm::vec3& b)
+	{
+		glm::vec3 d = glm::max(b - a, glm::vec3(0.0f));
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	};
+
+	float scale = BVH_SAH_BINS / extent[axis];
+	auto binOf = [&](uint32_t p)
+	{
+		int b = (int)((centroids[p][axis] - cmin[axis]) * scale);
+		return std::min(b, BVH_SAH_BINS - 1);
+	};
+
+	for (uint32_t i = start; i < end; i++)
+	{
+		uint32_t p = m_indices[i];
+		Bin& bin = bins[binOf(p)];
+		bin.m_min = glm::min(bin.m_min, bmin[p]);
+		bin.m_max = glm::max(bin.m_max, bmax[p]);
+		bin.m_count++;
+	}
+
+	float right_area[BVH_SAH_BINS];
+	uint32_t right_count[BVH_SAH_BINS];
+	glm::vec3 rmin = glm::vec3(FLT_MAX), rmax = glm::vec3(-FLT_MAX);
+	uint32_t rcount = 0;
+	for (int b = BVH_SAH_BINS - 1; b > 0; b--)
+	{
+		rmin = glm::min(rmin, bins[b].m_min);
+		rmax = glm::max(rmax, bins[b].m_max);
+		rcount += bins[b].m_count;
+		right_area[b] = area(rmin, rmax);
+		right_count[b] = rcount;
+	}
+
+	float best_cost = FLT_MAX;
+	int best_split = -1;
+	glm::vec3 lmin = glm::vec3(FLT_MAX), lmax = glm::vec3(-FLT_MAX);
+	uint32_t lcount = 0;
+	for (int b = 1; b < BVH_SAH_BINS; b++)
+	{
+		lmin = glm::min(lmin, bins[b - 1].m_min);
+		lmax = glm::max(lmax, bins[b - 1].m_max);
+		lcount += bins[b - 1].m_count;
+		if (lcount == 0 || right_count[b] == 0)
+			continue;
+		float cost = area(lmin, lmax) * lcount + right_area[b] * right_count[b];
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			best_split = b;
+		}
+	}
+
+	uint32_t mid;
+	if (best_split > 0)
+	{
+		uint32_t* first = m_indices.data() + start;
+		uint32_t* last = m_indices.data() + end;
+		mid = start + (uint32_t)(std::partition(first, last, [&](uint32_t p) { return binOf(p) < best_split; }) - first);
+	}
+	else
+	{
+		// all centroids fall in one bin; fall back to a median split
+		mid = start + count / 2;
+		std::nth_element(m_indices.begin() + start, m_indices.begin() + mid, m_indices.begin() + end,
+			[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+	}
+
+	buildRecursive(bmin, bmax, centroids, start, mid, depth + 1);
+	m_nodes[id].m_offset = (uint32_t)m_nodes.size();
+	m_nodes[id].m_count = 0;
+	buildRecursive(bmin, bmax, centroids, mid, end, depth + 1);
+}
@@ -0,0 +1,229 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#define BVH_MAX_DEPTH 64
+#define BVH_SAH_BINS 16
+#define BVH_PACKET_SIZE 8
+
+struct BVHNode
+{
+	glm::vec3 m_min;
+	uint32_t m_offset = 0; // first primitive for leaves, right child for inner nodes (left child is the next node)
+	glm::vec3 m_max;
+	uint32_t m_count = 0;  // number of primitives, 0 for inner nodes
+};
+
+// Rays traced together through the BVH, in structure-of-arrays layout so that the box tests
+// of all the rays of the packet vectorize.
+struct RayPacket
+{
+	float m_ox[BVH_PACKET_SIZE], m_oy[BVH_PACKET_SIZE], m_oz[BVH_PACKET_SIZE];
+	float m_dx[BVH_PACKET_SIZE], m_dy[BVH_PACKET_SIZE], m_dz[BVH_PACKET_SIZE];
+	float m_ix[BVH_PACKET_SIZE], m_iy[BVH_PACKET_SIZE], m_iz[BVH_PACKET_SIZE];
+	float m_tmax[BVH_PACKET_SIZE];
+	uint32_t m_ignore[BVH_PACKET_SIZE]; // primitive each ray starts from, skipped by the tests
+
+	void set(int lane, const glm::vec3& origin, const glm::vec3& dir, float tmax, uint32_t ignore = UINT32_MAX)
+	{
+		m_ox[lane] = origin.x; m_oy[lane] = origin.y; m_oz[lane] = origin.z;
+		m_dx[lane] = dir.x; m_dy[lane] = dir.y; m_dz[lane] = dir.z;
+		m_ix[lane] = 1.0f / dir.x; m_iy[lane] = 1.0f / dir.y; m_iz[lane] = 1.0f / dir.z;
+		m_tmax[lane] = tmax;
+		m_ignore[lane] = ignore;
+	}
+	glm::vec3 origin(int lane) const { return glm::vec3(m_ox[lane], m_oy[lane], m_oz[lane]); }
+	glm::vec3 direction(int lane) const { return glm::vec3(m_dx[lane], m_dy[lane], m_dz[lane]); }
+};
+
+// Bounding volume hierarchy over an arbitrary set of primitives given by their bounding boxes.
+// The primitive-specific tests are supplied by the caller to the query functions.
+class BVH
+{
+protected:
+	void buildRecursive(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax,
+		const std::vector<glm::vec3>& centroids, uint32_t start, uint32_t end, int depth);
+
+	int m_leaf_size = 4;
+
+public:
+	std::vector<BVHNode> m_nodes;
+	std::vector<uint32_t> m_indices; // primitive ids, referenced by the leaf ranges
+
+	void build(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax, int leaf_size = 4);
+	void clear() { m_nodes.clear(); m_indices.clear(); }
+	bool empty() const { return m_nodes.empty(); }
+
+	static float boxDistanceSquare(const BVHNode& node, const glm::vec3& q)
+	{
+		glm::vec3 d = glm::max(glm::max(node.m_min - q, q - node.m_max), glm::vec3(0.0f));
+		return glm::dot(d, d);
+	}
+
+	// Slab test of a ray against the node box. Returns the entry distance or FLT_MAX for a miss.
+	static float rayBoxDistance(const BVHNode& node, const glm::vec3& origin, const glm::vec3& inv_dir, float tmax)
+	{
+		glm::vec3 t0 = (node.m_min - origin) * inv_dir;
+		glm::vec3 t1 = (node.m_max - origin) * inv_dir;
+		glm::vec3 tmin3 = glm::min(t0, t1), tmax3 = glm::max(t0, t1);
+		float tnear = std::max(std::max(tmin3.x, tmin3.y), std::max(tmin3.z, 0.0f));
+		float tfar = std::min(std::min(tmax3.x, tmax3.y), std::min(tmax3.z, tmax));
+		return tnear <= tfar ? tnear : FLT_MAX;
+	}
+
+	// Traces a ray. test(prim_id, tmax) must return true and shrink tmax if the primitive is hit
+	// closer than tmax. With any_hit, the traversal stops at the first hit (occlusion queries).
+	template <typename Test>
+	bool intersect(const glm::vec3& origin, const glm::vec3& dir, float& tmax, Test test, bool any_hit = false) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		glm::vec3 inv_dir = 1.0f / dir;
+		uint32_t stack[2 * BVH_MAX_DEPTH];
+		int sp = 0;
+		stack[sp++] = 0;
+		bool hit = false;
+		while (sp > 0)
+		{
+			uint32_t id = stack[--sp];
+			const BVHNode& node = m_nodes[id];
+			if (rayBoxDistance(node, origin, inv_dir, tmax) == FLT_MAX)
+				continue;
+			if (node.m_count > 0)
+			{
+				for (uint32_t i = node.m_offset; i < node.m_offset + node.m_count; i++)
+				{
+					if (test(m_indices[i], tmax))
+					{
+						hit = true;
+						if (any_hit)
+							return true;
+					}
+				}
+				continue;
+			}
+			uint32_t left = id + 1, right = node.m_offset;
+			float dl = rayBoxDistance(m_nodes[left], origin, inv_dir, tmax);
+			float dr = rayBoxDistance(m_nodes[right], origin, inv_dir, tmax);
+			if (dl < dr)
+			{
+				if (dr != FLT_MAX) stack[sp++] = right;
+				stack[sp++] = left;
+			}
+			else
+			{
+				if (dl != FLT_MAX) stack[sp++] = left;
+				if (dr != FLT_MAX) stack[sp++] = right;
+			}
+		}
+		return hit;
+	}
+
+	// Bit mask of the packet rays that intersect the node box.
+	static uint32_t rayBoxMask(const BVHNode& node, const RayPacket& packet)
+	{
+		uint32_t mask = 0;
+		for (int i = 0; i < BVH_PACKET_SIZE; i++)
+		{
+			float tx0 = (node.m_min.x - packet.m_ox[i]) * packet.m_ix[i];
+			float tx1 = (node.m_max.x - packet.m_ox[i]) * packet.m_ix[i];
+			float ty0 = (node.m_min.y - packet.m_oy[i]) * packet.m_iy[i];
+			float ty1 = (node.m_max.y - packet.m_oy[i]) * packet.m_iy[i];
+			float tz0 = (node.m_min.z - packet.m_oz[i]) * packet.m_iz[i];
+			float tz1 = (node.m_max.z - packet.m_oz[i]) * packet.m_iz[i];
+			float tnear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+			float tfar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), packet.m_tmax[i]));
+			mask |= (tnear <= tfar ? 1u : 0u) << i;
+		}
+		return mask;
+	}
+
+	// Occlusion test of the active rays of a packet, traversing the hierarchy once for all of them.
+	// test(prim_id, lane) returns true if the primitive blocks the ray. Returns the occluded rays.
+	template <typename Test>
+	uint32_t occluded(const RayPacket& packet, uint32_t active, Test test) const
+	{
+		uint32_t result = 0;
+		if (m_nodes.empty())
+			return result;
+
+		uint32_t stack[2 * BVH_MAX_DEPTH];
+		int sp = 0;
+		stack[sp++] = 0;
+		while (sp > 0 && active)
+		{
+			uint32_t id = stack[--sp];
+			const BVHNode& node = m_nodes[id];
+			uint32_t hits = rayBoxMask(node, packet) & active;
+			if (!hits)
+				continue;
+			if (node.m_count > 0)
+			{
+				for (int lane = 0; lane < BVH_PACKET_SIZE; lane++)
+				{
+					if (!(hits & (1u << lane)))
+						continue;
+					for (uint32_t i = node.m_offset; i < node.m_offset + node.m_count; i++)
+					{
+						if (test(m_indices[i], lane))
+						{
+							result |= 1u << lane;
+							active &= ~(1u << lane);
+							break;
+						}
+					}
+				}
+				continue;
+			}
+			stack[sp++] = node.m_offset;
+			stack[sp++] = id + 1;
+		}
+		return result;
+	}
+
+	// Finds the primitive closest to q. test(prim_id, max_distance) must return true and shrink
+	// max_distance if the primitive lies closer than max_distance. Returns true if any primitive was closer.
+	template <typename Test>
+	bool closest(const glm::vec3& q, float& max_distance, Test test) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		uint32_t stack[2 * BVH_MAX_DEPTH];
+		int sp = 0;
+		stack[sp++] = 0;
+		bool found = false;
+		while (sp > 0)
+		{
+			uint32_t id = stack[--sp];
+			const BVHNode& node = m_nodes[id];
+			if (boxDistanceSquare(node, q) > max_distance * max_distance)
+				continue;
+			if (node.m_count > 0)
+			{
+				for (uint32_t i = node.m_offset; i < node.m_offset + node.m_count; i++)
+					found |= test(m_indices[i], max_distance);
+				continue;
+			}
+			// visit the nearest child first, to shrink the search radius early
+			uint32_t left = id + 1, right = node.m_offset;
+			float dl = boxDistanceSquare(m_nodes[left], q);
+			float dr = boxDistanceSquare(m_nodes[right], q);
+			if (dl < dr)
+			{
+				stack[sp++] = right;
+				stack[sp++] = left;
+			}
+			else
+			{
+				stack[sp++] = left;
+				stack[sp++] = right;
+			}
+		}
+		return found;
+	}
+};
@@ -4,6 +4,10 @@
 #define TEXFORMAT_BGR 2
 #define TEXFORMAT_RGBA 3
 #define TEXFORMAT_BGRA 4
+// block-compressed formats, decoded to RGBA on access
+#define TEXFORMAT_BC1 5
+#define TEXFORMAT_BC3 6
+#define TEXFORMAT_BC7 7
 
 #define TEXSAMPLING_NEAREST 0
 #define TEXSAMPLING_LINEAR 1
@@ -12,10 +16,15 @@
 
 #define SAMPLER_MODE_UNIFORM 1
 #define SAMPLER_MODE_STRATIFIED 2
+#define SAMPLER_MODE_SDF 3
+#define SAMPLER_MODE_VOLUME 4
 
 #define MASK_VERTICES 1
 #define MASK_NORMALS 2
 #define MASK_COLORS 4
+#define MASK_DISTANCE 8
+#define MASK_OCCUPANCY 16
+#define MASK_OCCLUSION 32
 
 
 #define PI 3.14159265f
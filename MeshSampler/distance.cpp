@@ -0,0 +1,163 @@
+#include "distance.h"
+#include "mesh.h"
+#include "ply.h"
+#include "defs.h"
+#include <omp.h>
+#include <algorithm>
+
+void DistanceStats::add(float d)
+{
+	m_count++;
+	m_sum += d;
+	m_sum_sq += (double)d * d;
+	m_max = std::max(m_max, d);
+
+	int bin = 0;
+	float edge = m_reference * 1.0e-6f;
+	while (bin < DISTANCE_HISTOGRAM_BINS - 1 && d >= edge)
+	{
+		bin++;
+		edge *= 10.0f;
+	}
+	m_histogram[bin]++;
+}
+
+void DistanceStats::merge(const DistanceStats& other)
+{
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+	m_sum_sq += other.m_sum_sq;
+	m_max = std::max(m_max, other.m_max);
+	for (int i = 0; i < DISTANCE_HISTOGRAM_BINS; i++)
+		m_histogram[i] += other.m_histogram[i];
+}
+
+void DistanceStats::print(const char* title) const
+{
+	printf("%s (%zu points):\n", title, m_count);
+	printf("  mean: %g\n  rms: %g\n  max (Hausdorff): %g\n", mean(), rms(), m_max);
+	printf("  histogram (relative to bounding box diagonal %g):\n", m_reference);
+	float low = 0.0f, high = 1.0e-6f;
+	for (int i = 0; i < DISTANCE_HISTOGRAM_BINS; i++)
+	{
+		float percent = m_count ? 100.0f * m_histogram[i] / (float)m_count : 0.0f;
+		if (i < DISTANCE_HISTOGRAM_BINS - 1)
+			printf("    [%.0e, %.0e): %12zu %5.1f%%\n", low, high, m_histogram[i], percent);
+		else
+			printf("    [%.0e,   inf): %12zu %5.1f%%\n", low, m_histogram[i], percent);
+		low = high;
+		high *= 10.0f;
+	}
+}
+
+DistanceEvaluator::DistanceEvaluator(Mesh* m)
+{
+	m_mesh = m;
+	setMemoryLimit(64);
+}
+
+void DistanceEvaluator::setMemoryLimit(int mbytes)
+{
+	m_mem_limit = 1024 * 1024 * (size_t)mbytes;
+	// position and distance per point
+	m_chunk_points = std::max<size_t>(1, m_mem_limit / (sizeof(float) * 4));
+}
+
+bool DistanceEvaluator::pointsToMesh(std::string input, std::string output, DistanceStats& stats)
+{
+	if (m_mesh->m_bvh.empty())
+		m_mesh->buildBVH();
+	return process(input, output, stats, true);
+}
+
+bool DistanceEvaluator::samplesToPoints(std::string input, std::string points_file, std::string output, DistanceStats& stats)
+{
+	PlyReader reader;
+	if (!plyOpen(points_file, reader))
+		return false;
+	m_points.resize(reader.m_count);
+	size_t count = plyReadPoints(reader, m_points, reader.m_count);
+	plyClose(reader);
+	if (count == 0)
+	{
+		printf("No points found in %s\n", points_file.c_str());
+		return false;
+	}
+
+	m_points_bvh.build(m_points, m_points, 8);
+	bool ok = process(input, output, stats, false);
+
+	m_points_bvh.clear();
+	m_points.clear();
+	m_points.shrink_to_fit();
+	return ok;
+}
+
+bool DistanceEvaluator::process(std::string input, std::string output, DistanceStats& stats, bool to_mesh)
+{
+	PlyReader reader;
+	if (!plyOpen(input, reader))
+		return false;
+	if (!plyInit(output, MASK_VERTICES | MASK_DISTANCE, 0))
+	{
+		plyClose(reader);
+		return false;
+	}
+
+	stats = DistanceStats();
+	stats.m_reference = glm::length(m_mesh->m_max - m_mesh->m_min);
+
+	std::vector<glm::vec3> points;
+	std::vector<float> distances;
+	size_t total = 0;
+	bool ok = true;
+
+	printf("Progress: %4.1f%%", 0.0f);
+
+	while (ok && plyReadPoints(reader, points, m_chunk_points) > 0)
+	{
+		long long n = (long long)points.size();
+		distances.resize(n);
+#pragma omp parallel
+		{
+			DistanceStats local;
+			local.m_reference = stats.m_reference;
+#pragma omp for schedule(dynamic, 1024)
+			for (long long i = 0; i < n; i++)
+			{
+				float d = FLT_MAX;
+				if (to_mesh)
+				{
+					glm::vec3 cp, normal;
+					d = m_mesh->getPointToMeshDistance(points[i], cp, normal);
+				}
+				else
+				{
+					const glm::vec3& q = points[i];
+					m_points_bvh.closest(q, d, [&](uint32_t id, float& max_distance)
+						{
+							float dist = glm::distance(q, m_points[id]);
+							if (dist >= max_distance)
+								return false;
+							max_distance = dist;
+							return true;
+						});
+				}
+				distances[i] = d;
+				local.add(d);
+			}
+#pragma omp critical
+			stats.merge(local);
+		}
+
+		total += n;
+		ok = plyUpdateHeader(output, total);
+		ok = ok && plyAppendPoints(output, MASK_VERTICES | MASK_DISTANCE, &points, nullptr, nullptr, &distances);
+
+		printf("\b\b\b\b\b%4.1f%%", 100.0f * std::min(1.0f, total / (float)std::max<size_t>(1, reader.m_count)));
+	}
+	plyClose(reader);
+
+	printf("\b\b\b\b\b100.0%%...%s\n", ok ? "done." : "failed.");
+	return ok;
+}
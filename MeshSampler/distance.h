@@ -0,0 +1,50 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include "bvh.h"
+
+#define DISTANCE_HISTOGRAM_BINS 7
+
+// Aggregate statistics of a set of point distances. The histogram bins are decades of a
+// reference length (the mesh bounding box diagonal): [0, 1e-6), [1e-6, 1e-5), ..., [1e-1, inf).
+struct DistanceStats
+{
+	size_t m_count = 0;
+	double m_sum = 0.0;
+	double m_sum_sq = 0.0;
+	float m_max = 0.0f;
+	float m_reference = 1.0f;
+	size_t m_histogram[DISTANCE_HISTOGRAM_BINS] = {};
+
+	void add(float d);
+	void merge(const DistanceStats& other);
+	double mean() const { return m_count ? m_sum / m_count : 0.0; }
+	double rms() const { return m_count ? sqrt(m_sum_sq / m_count) : 0.0; }
+	void print(const char* title) const;
+};
+
+// Computes per-point distances between point clouds stored in PLY files and a mesh, streaming
+// the input in chunks and writing the points along with their distance to a new PLY file.
+class DistanceEvaluator
+{
+	class Mesh* m_mesh = nullptr;
+	size_t m_mem_limit = 1024 * 1024 * 64;
+	size_t m_chunk_points = 1;
+
+	// target point cloud for the mesh-to-points direction
+	std::vector<glm::vec3> m_points;
+	BVH m_points_bvh;
+
+	bool process(std::string input, std::string output, DistanceStats& stats, bool to_mesh);
+
+public:
+	DistanceEvaluator(Mesh* m);
+
+	void setMemoryLimit(int mbytes);
+
+	// distances from the points in the input file to the mesh surface
+	bool pointsToMesh(std::string input, std::string output, DistanceStats& stats);
+	// distances from the (mesh) samples in the input file to the nearest point of the cloud in points_file
+	bool samplesToPoints(std::string input, std::string points_file, std::string output, DistanceStats& stats);
+};
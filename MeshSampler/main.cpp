@@ -1,5 +1,7 @@
 #include "mesh.h"
 #include "sampling.h"
+#include "distance.h"
+#include "TextureManager.h"
 #include "defs.h"
 #include <string>
 
@@ -20,13 +22,73 @@ void printHelp()
 	printf("             Default is 64 (Mbytes). More memory -> fewer disk accesses\n");
 	printf("             to append chunks of samples to file.\n");
 	printf("  -c:        Additionally, sample colors. Textures are properly sampled,\n");
-	printf("             if present.\n");
+	printf("             if present. BC1, BC3 and BC7 textures in DDS or KTX files stay\n");
+	printf("             compressed in memory and are decoded block by block on lookup;\n");
+	printf("             -tm and -tc do not apply to them.\n");
 	printf("  -n:        Additionally, sample normals.\n");
 	printf("  -f FILTER: Texture sampling magnification filter. FILTER:\n");
 	printf("             \"nearest\": samples the closest texel.\n");
 	printf("             \"linear\": linearly blend the 4 closest texels. Default filter.\n");
 	printf("             \"sharp\": blend the 4 closest texels with cosine interpolation.\n");
-	printf("             \"smooth\": 16-tap random texel selection with cosine distance weighting.\n");
+	printf("             \"smooth\": prefiltered (mipmapped) lookup matching the local sample\n");
+	printf("                       density, at least 2 texels wide.\n");
+	printf("  -tm MEMORY: Texture memory budget in Mbytes. Textures are converted to tiled\n");
+	printf("             \".mstx\" files next to the original images (reused by later runs)\n");
+	printf("             and their tiles are loaded on demand, keeping at most MEMORY Mbytes\n");
+	printf("             of texels in memory. Textures are decoded one at a time, each\n");
+	printf("             held in memory with its mipmaps until it is tiled.\n");
+	printf("             Default is 0: all textures are kept in memory.\n");
+	printf("  -tc DIR:   Texture cache directory. Decoded textures are stored there as tiled\n");
+	printf("             \".mstx\" files, which later runs memory map instead of decoding the\n");
+	printf("             images again, as long as the images are unchanged. With -tm, the\n");
+	printf("             tiled files are kept there instead of next to the images.\n");
+	printf("  -to:       With -c, sample the triangles grouped by texture and in texture\n");
+	printf("             space order, so that each texture is streamed through memory once.\n");
+	printf("  -mm:       Memory map the mesh from a binary store \"filename.msm\" next to\n");
+	printf("             the OBJ file, built on first use and reused while the OBJ file is\n");
+	printf("             unchanged. Meshes larger than the physical memory are sampled by\n");
+	printf("             streaming through the store instead of swapping.\n");
+	printf("  -ro:       Reorder the triangles and vertices along a space-filling curve, so that\n");
+	printf("             neighbouring triangles are close in memory. Speeds up meshes whose\n");
+	printf("             faces are shuffled; with -mm, the store is built reordered.\n");
+	printf("  -weld:     Weld identical vertices and remove duplicated triangles and triangles\n");
+	printf("             without area, so that stacked faces are not sampled twice. With -mm,\n");
+	printf("             the store is built welded.\n");
+	printf("  -sn ANGLE: With -n, give the faces without normals smooth vertex normals, not\n");
+	printf("             averaged across edges sharper than ANGLE degrees, instead of their\n");
+	printf("             face normal. 180 smooths all the edges.\n");
+	printf("  -q BITS:   Quantize the vertex positions to 16 or 21 BITS per axis, relative to\n");
+	printf("             clusters of consecutive vertices, and the normals to 32-bit octahedral\n");
+	printf("             coordinates, for meshes too large for float vertices. Requires -mm,\n");
+	printf("             the float vertices are streamed from the store instead of being held\n");
+	printf("             in memory. Best with -ro. Ignored with -d, -sdf, -v, -ao and -vis.\n");
+	printf("  -ao RAYS:  Additionally, compute the ambient occlusion of each sample from RAYS\n");
+	printf("             cosine-distributed rays around the sample normal.\n");
+	printf("  -aod DISTANCE: With -ao, maximum distance of occluders, relative to the bounding\n");
+	printf("             box diagonal. Default is unbounded.\n");
+	printf("  -vis VIEWS: Restrict the samples to the surfaces visible from VIEWS directions\n");
+	printf("             evenly distributed around the mesh, skipping interior and occluded\n");
+	printf("             triangles.\n");
+	printf("  -visd DISTANCE: With -vis, use viewpoints at DISTANCE (relative to the bounding\n");
+	printf("             box diagonal) from the mesh center instead of directions.\n");
+	printf("  -visw:     With -vis, distribute the samples proportionally to the fraction of\n");
+	printf("             views each triangle is visible from.\n");
+	printf("  -sdf SIGMA: Signed distance mode. Emits surface samples, samples offset along\n");
+	printf("             the surface normal by a gaussian distance with standard deviation\n");
+	printf("             SIGMA (relative to the bounding box diagonal, e.g. 0.005) and\n");
+	printf("             uniform samples in the bounding box, each with its signed distance\n");
+	printf("             to the mesh, negative inside (by the generalized winding number).\n");
+	printf("             Results are written to \".sdf.ply\". Cannot be combined with -d.\n");
+	printf("  -v NUMBER: Additionally, draw NUMBER uniform samples in the bounding box of the\n");
+	printf("             mesh, labelled as inside (1) or outside (0) by their generalized\n");
+	printf("             winding number, which is robust to holes. Results are written to\n");
+	printf("             a PLY file with an extension \".volume.ply\".\n");
+	printf("  -d FILE:   Distance mode. Computes the distance of each point of the PLY point\n");
+	printf("             cloud FILE to the mesh and writes the points along with their\n");
+	printf("             distance to \"FILE.distance.ply\". Mean, RMS, max (Hausdorff)\n");
+	printf("             distance and a histogram are reported.\n");
+	printf("  -sym:      With -d, also samples the mesh and measures the distance of the\n");
+	printf("             samples to the point cloud, reporting symmetric metrics.\n");
 	printf("\n");
 	printf("Example:\n");
 	printf("MeshSampler -s 20000000 -m 100 -c -n -f sharp data\\cloister.obj\n");
@@ -36,9 +98,27 @@ struct Params
 {
 	int attribs = MASK_VERTICES;
 	int texfilter = TEXSAMPLING_LINEAR;
+	int mode = SAMPLER_MODE_UNIFORM;
+	float sdf_sigma = 0.005f;
+	int aorays = 0;
+	float aodistance = 0.0f;
+	int visviews = 0;
+	float visdistance = 0.0f;
+	bool visweighting = false;
 	size_t numsamples = 1000000;
+	size_t volumesamples = 0;
 	int mem = 64;
+	int texmem = 0;
+	std::string texcache;
+	bool texorder = false;
+	bool mapped = false;
+	bool reorder = false;
+	bool weld = false;
+	float crease_angle = -1.0f;
+	int quantize = 0;
 	std::string filename;
+	std::string distance_filename;
+	bool symmetric = false;
 };
 
 void parseArgs(int argc, char** argv, Params& params)
@@ -49,10 +129,50 @@ void parseArgs(int argc, char** argv, Params& params)
 			params.numsamples = std::stoll(argv[++a]);
 		else if (strcmp("-m", argv[a]) == 0)
 			params.mem = std::stoi(argv[++a]);
+		else if (strcmp("-tm", argv[a]) == 0)
+			params.texmem = std::stoi(argv[++a]);
+		else if (strcmp("-tc", argv[a]) == 0)
+			params.texcache = argv[++a];
+		else if (strcmp("-to", argv[a]) == 0)
+			params.texorder = true;
+		else if (strcmp("-mm", argv[a]) == 0)
+			params.mapped = true;
+		else if (strcmp("-ro", argv[a]) == 0)
+			params.reorder = true;
+		else if (strcmp("-weld", argv[a]) == 0)
+			params.weld = true;
+		else if (strcmp("-sn", argv[a]) == 0)
+			params.crease_angle = std::stof(argv[++a]);
+		else if (strcmp("-q", argv[a]) == 0)
+			params.quantize = std::stoi(argv[++a]);
 		else if (strcmp("-c", argv[a]) == 0)
 			params.attribs |= MASK_COLORS;
 		else if (strcmp("-n", argv[a]) == 0)
 			params.attribs |= MASK_NORMALS;
+		else if (strcmp("-ao", argv[a]) == 0)
+		{
+			params.attribs |= MASK_OCCLUSION;
+			params.aorays = std::stoi(argv[++a]);
+		}
+		else if (strcmp("-aod", argv[a]) == 0)
+			params.aodistance = std::stof(argv[++a]);
+		else if (strcmp("-vis", argv[a]) == 0)
+			params.visviews = std::stoi(argv[++a]);
+		else if (strcmp("-visd", argv[a]) == 0)
+			params.visdistance = std::stof(argv[++a]);
+		else if (strcmp("-visw", argv[a]) == 0)
+			params.visweighting = true;
+		else if (strcmp("-sdf", argv[a]) == 0)
+		{
+			params.mode = SAMPLER_MODE_SDF;
+			params.sdf_sigma = std::stof(argv[++a]);
+		}
+		else if (strcmp("-v", argv[a]) == 0)
+			params.volumesamples = std::stoll(argv[++a]);
+		else if (strcmp("-d", argv[a]) == 0)
+			params.distance_filename = argv[++a];
+		else if (strcmp("-sym", argv[a]) == 0)
+			params.symmetric = true;
 		else if (strcmp("-f", argv[a]) == 0)
 		{
 			if (strcmp("nearest", argv[++a]) == 0)
@@ -77,22 +197,127 @@ int main(int argc, char** argv)
 	Params params;
 	parseArgs(argc, argv, params);
 
+	TextureManager::getInstance().setMemoryBudget(params.texmem);
+	TextureManager::getInstance().setCacheDirectory(params.texcache);
+
+	if (params.mode == SAMPLER_MODE_SDF && !params.distance_filename.empty())
+	{
+		printf("-sdf cannot be combined with -d\n");
+		return -1;
+	}
+	// the float vertices are only paged in from the store while they are quantized
+	if (params.quantize > 0 && !params.mapped)
+	{
+		printf("-q requires -mm\n");
+		return -1;
+	}
+
+	// only load the mesh attributes and textures the outputs need
+	bool sdf = params.mode == SAMPLER_MODE_SDF;
+	int load_attribs = params.attribs;
+	if ((params.attribs & MASK_OCCLUSION) || sdf)
+		load_attribs |= MASK_NORMALS;
+	if (sdf)
+		load_attribs &= ~MASK_COLORS;
+
 	Mesh mesh;
-	mesh.readobj(params.filename);
+	if (params.mapped)
+		mesh.readMapped(params.filename, load_attribs, params.reorder, params.weld, params.crease_angle);
+	else
+	{
+		mesh.readobj(params.filename, load_attribs, params.crease_angle);
+		if (params.weld)
+			mesh.weld();
+		if (params.reorder)
+			mesh.reorder();
+	}
 
-	printf("Read OBJ model %s with %u faces\n", mesh.m_filename.c_str(), mesh.m_triangles.size());
+	printf("Read OBJ model %s with %zu faces\n", mesh.m_filename.c_str(), mesh.getNumTriangles());
+
+	// the BVH of the proximity and visibility queries holds 32-bit triangle ids
+	bool bvh = sdf || params.volumesamples > 0 || !params.distance_filename.empty() || (params.attribs & MASK_OCCLUSION) || params.visviews > 0;
+	if (bvh && mesh.getNumTriangles() > UINT32_MAX)
+	{
+		printf("-d, -sdf, -v, -ao and -vis are limited to 2^32 triangles\n");
+		return -1;
+	}
+
+	// the proximity queries of the other modes need float vertices
+	if (params.quantize > 0)
+	{
+		if (bvh)
+			printf("Quantization is not supported with -d, -sdf, -v, -ao and -vis, keeping float vertices\n");
+		else
+			mesh.quantize(params.quantize);
+	}
+
+	DistanceStats forward, backward;
+	if (!params.distance_filename.empty())
+	{
+		DistanceEvaluator evaluator(&mesh);
+		evaluator.setMemoryLimit(params.mem);
+		printf("Computing point to mesh distances for %s\n", params.distance_filename.c_str());
+		if (!evaluator.pointsToMesh(params.distance_filename, params.distance_filename + ".distance.ply", forward))
+			return -1;
+		forward.print("Points to mesh distance");
+		if (!params.symmetric)
+			return 0;
+	}
 
 	MeshSampler sampler(&mesh);
 
 	sampler.setNumSamples(params.numsamples);
-	sampler.setMode(SAMPLER_MODE_UNIFORM);
-	sampler.setOutputFilename(mesh.m_filename + ".sampled.ply");
+	if (sdf)
+	{
+		sampler.setMode(SAMPLER_MODE_SDF);
+		sampler.setSDFParameters(params.sdf_sigma, 0.5f, 0.1f);
+		sampler.setOutputFilename(mesh.m_filename + ".sdf.ply");
+	}
+	else
+	{
+		sampler.setMode(SAMPLER_MODE_UNIFORM);
+		sampler.setOutputFilename(mesh.m_filename + ".sampled.ply");
+	}
 	sampler.setMemoryLimit(params.mem); // in mb.
 	sampler.setSamplingAttributeMask(params.attribs);
+	sampler.setTextureFiltering(params.texfilter);
+	sampler.setTextureOrder(params.texorder);
+	sampler.setVisibility(params.visviews, params.visdistance, params.visweighting);
+	sampler.setAmbientOcclusion(params.aorays, params.aodistance);
 	
 
 	if (!sampler.sample())
 		return -1;
+	TextureManager::getInstance().printStatistics();
+
+	if (params.volumesamples > 0)
+	{
+		MeshSampler volume(&mesh);
+		volume.setNumSamples(params.volumesamples);
+		volume.setMode(SAMPLER_MODE_VOLUME);
+		volume.setOutputFilename(mesh.m_filename + ".volume.ply");
+		volume.setMemoryLimit(params.mem);
+		volume.setSamplingAttributeMask(MASK_VERTICES | MASK_OCCUPANCY);
+		printf("Sampling the volume\n");
+		if (!volume.sample())
+			return -1;
+	}
+
+	if (!params.distance_filename.empty())
+	{
+		DistanceEvaluator evaluator(&mesh);
+		evaluator.setMemoryLimit(params.mem);
+		std::string samples = mesh.m_filename + ".sampled.ply";
+		printf("Computing mesh to point distances for %s\n", params.distance_filename.c_str());
+		if (!evaluator.samplesToPoints(samples, params.distance_filename, samples + ".distance.ply", backward))
+			return -1;
+		backward.print("Mesh to points distance");
+
+		printf("Symmetric distance:\n");
+		printf("  Chamfer (sum of means): %g\n", forward.mean() + backward.mean());
+		printf("  Chamfer (sum of mean squares): %g\n", forward.rms() * forward.rms() + backward.rms() * backward.rms());
+		printf("  Hausdorff: %g\n", std::max(forward.m_max, backward.m_max));
+	}
 
 	return 0;
 }
\ No newline at end of file
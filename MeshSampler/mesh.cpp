@@ -7,13 +7,17 @@
 #include <atomic>
 #include <omp.h>
 #include <algorithm>
+#include <filesystem>
 #include "sampling.h"
 #include "ply.h"
 #include <iostream>
 #include <sstream>
 #include <functional>
+#include <type_traits>
+#include <array>
 #include "util.h"
 #include "TextureManager.h"
+#include "winding.h"
 
 #define STR_EQUAL(_a,_b)       (_a && _b && !_stricmp (_a,_b))
 
@@ -38,21 +42,22 @@ bool vec_equal(glm::vec3 v1, glm::vec3 v2)
 	return glm::all(glm::lessThan(glm::abs(v1 - v2), glm::vec3(0.00001f)));
 }
 
-class TriSorter
+// directory path of a file, with the trailing delimiter
+static std::string directoryOf(const std::string& filename)
 {
-public:
-	bool operator () (const Triangle * & left, const Triangle * & right) 
-	{
-		return left->m_area < right->m_area;
-	}
-};
-
+	size_t delim_pos = filename.rfind('\\');
+	if (delim_pos == std::string::npos)
+		delim_pos = filename.rfind('/');
+	if (delim_pos == std::string::npos)
+		return "";
+	return filename.substr(0, delim_pos + 1);
+}
 
 Mesh::~Mesh()
 {
 
 }
-bool Mesh::readMTL(std::string filename)
+bool Mesh::readMTL(std::string filename, bool load_textures)
 {
 	std::ifstream in(filename, std::ios::in);
 	if (!in)
@@ -130,19 +135,91 @@ bool Mesh::readMTL(std::string filename)
 			std::istringstream s(line.substr(7));
 			s >> m_materials[cur_mat].m_texture_file_color;
 			m_materials[cur_mat].m_texture_file_color = folder + m_materials[cur_mat].m_texture_file_color;
-			m_materials[cur_mat].m_tid_color = TextureManager::getInstance().getTextureID(m_materials[cur_mat].m_texture_file_color);
+			if (load_textures)
+				m_materials[cur_mat].m_tid_color = TextureManager::getInstance().getTextureID(m_materials[cur_mat].m_texture_file_color);
 		}
 	}
 	in.close();
+	return true;
+}
+
+// element counts of an OBJ file
+struct ObjCounts
+{
+	size_t m_vertices = 0;
+	size_t m_normals = 0;
+	size_t m_coords = 0;
+	size_t m_faces = 0;
+	size_t m_faces_without_normals = 0; // faces given a geometric normal
+};
+
+// counts the elements with a pass over the bytes of the file, so that the arrays are allocated
+// once instead of growing (and being copied) while the file is parsed
+static ObjCounts countObjElements(FILE* file)
+{
+	ObjCounts counts;
+	std::vector<char> block(1 << 20);
+	char first = 0, second = 0;
+	size_t column = 0;
+	int token = 0;   // first vertex of a face: 0 before it, 1 in it, 2 after it
+	int slashes = 0; // in the first vertex of a face
+	auto endLine = [&]()
+	{
+		if (first == 'v' && (second == ' ' || second == '\t'))
+			counts.m_vertices++;
+		else if (first == 'v' && second == 'n')
+			counts.m_normals++;
+		else if (first == 'v' && second == 't')
+			counts.m_coords++;
+		else if (first == 'f' && (second == ' ' || second == '\t'))
+		{
+			counts.m_faces++;
+			if (slashes < 2)
+				counts.m_faces_without_normals++;
+		}
+		first = second = 0;
+		column = 0;
+		token = slashes = 0;
+	};
+	size_t read;
+	while ((read = fread(block.data(), 1, block.size(), file)) > 0)
+	{
+		for (size_t i = 0; i < read; i++)
+		{
+			char c = block[i];
+			if (c == '\n')
+			{
+				endLine();
+				continue;
+			}
+			if (column == 0)
+				first = c;
+			else if (column == 1)
+				second = c;
+			else if (first == 'f' && token < 2)
+			{
+				bool space = c == ' ' || c == '\t' || c == '\r';
+				if (token == 0 && !space)
+					token = 1;
+				else if (token == 1 && space)
+					token = 2;
+				if (c == '/')
+					slashes++;
+			}
+			column++;
+		}
+	}
+	endLine();
+	rewind(file);
+	return counts;
 }
 
-bool Mesh::readobj(std::string filename)
+bool Mesh::readobj(std::string filename, int attribs, float crease_angle)
 {
 	FILE *file;
 	char buf[256];
 	char buf1[256];
 
-	Material cur_material;
 	TriangleGroup cur_group;
 	fopen_s(&file, filename.c_str(), "rt");
 	if (!file)
@@ -150,22 +227,37 @@ bool Mesh::readobj(std::string filename)
 
 	m_filename = filename;
 
-	unsigned int vertices = 0;
-	unsigned int normals = 0;
-	unsigned int texcoords = 0;
+	size_t vertices = 0;
+	size_t normals = 0;
+	size_t texcoords = 0;
 	float x, y, z;
-	unsigned int v, n, t;
-	unsigned int n_drift = 0;
-
-	// extract the directory path of the file to open
-	size_t delim_pos = filename.rfind('\\');
-	if (delim_pos == std::string::npos)
-		delim_pos = filename.rfind('/');
-	std::string path;
-	if (delim_pos == std::string::npos)
-		path = "";
-	else
-		path = filename.substr(0, delim_pos + 1);
+	// 64-bit indices; the index buffers are widened when needed
+	unsigned long long v, n, t;
+	unsigned long long n_drift = 0;
+	bool load_normals = (attribs & MASK_NORMALS) != 0;
+	bool load_coords = (attribs & MASK_COLORS) != 0;
+	// faces without normals get smooth vertex normals after parsing instead of a normal each
+	bool smooth_normals = load_normals && crease_angle >= 0.0f;
+	std::vector<unsigned char> missing_normals;
+
+	std::string path = directoryOf(filename);
+
+	ObjCounts counts = countObjElements(file);
+	m_vertex_buffer.reserve(counts.m_vertices);
+	m_vertex_indices.reserve(3 * counts.m_faces, counts.m_vertices);
+	m_triangle_groups.reserve(counts.m_faces);
+	if (load_normals)
+	{
+		m_normal_buffer.reserve(counts.m_normals + (smooth_normals ? 0 : counts.m_faces_without_normals));
+		m_normal_indices.reserve(3 * counts.m_faces, counts.m_normals + counts.m_faces_without_normals);
+	}
+	if (smooth_normals)
+		missing_normals.reserve(counts.m_faces);
+	if (load_coords)
+	{
+		m_coords_buffer.reserve(counts.m_coords);
+		m_coords_indices.reserve(3 * counts.m_faces, counts.m_coords);
+	}
 
 	while (!feof(file))
 	{
@@ -177,23 +269,15 @@ bool Mesh::readobj(std::string filename)
 			m_mtl_filename = std::string(buf1);
 			std::string matlib_path = path + m_mtl_filename;
 			// do something with the matlib file. Not needed for basic operation.
-			readMTL(matlib_path);
+			readMTL(matlib_path, load_coords);
 		}
 		
 		if (STR_EQUAL(buf, "usemtl"))
 		{
 			fscanf_s(file, "%s", buf1, 255);
-			std::string mat_name = std::string(buf1);
-			auto itr = m_materials.find(mat_name);
-			if (itr == m_materials.end())
-			{
-				cur_material = Material();
-				cur_material.m_name = mat_name;
-				m_materials[mat_name] = cur_material;
-			}
-			else
-				cur_material = itr->second;
-			cur_group.matname = mat_name;
+			cur_group.matname = buf1;
+			if (m_materials.find(cur_group.matname) == m_materials.end())
+				m_materials[cur_group.matname].m_name = cur_group.matname;
 		}
 		
 		glm::vec3 vec;
@@ -216,12 +300,14 @@ bool Mesh::readobj(std::string filename)
 				break;
 			case 'n': // vn
 				fscanf_s(file, "%f %f %f", &x, &y, &z);
-				m_normal_buffer.push_back(glm::vec3(x, y, z));
+				if (load_normals)
+					m_normal_buffer.push_back(glm::vec3(x, y, z));
 				normals++;
 				break;
 			case 't': // vt
 				fscanf_s(file, "%f %f", &x, &y);
-				m_coords_buffer.push_back(glm::vec3(x, y, 0.0f));
+				if (load_coords)
+					m_coords_buffer.push_back(glm::vec3(x, y, 0.0f));
 				texcoords++;
 				break;
 			}
@@ -231,85 +317,79 @@ bool Mesh::readobj(std::string filename)
 			if (cur_group.m_length > 0)
 				m_groups.push_back(cur_group);
 			cur_group = TriangleGroup();
-			cur_group.m_start = (unsigned int) m_triangles.size();
+			cur_group.m_start = getNumTriangles();
 			break;
 		case 'c':
 			fgets(buf, sizeof(buf), file);
 			sscanf_s(buf, "%f", &(cur_group.m_classification));
 			break;
 		case 'f':
+		{
 			// if no tex coords are given, create a dummy pair.
-			
+			unsigned long long tv[3], tn[3] = { 0, 0, 0 }, tt[3] = { 0, 0, 0 };
+			bool face_normal = false;
 			fscanf_s(file, "%s", buf, 255);
 			if (strstr(buf, "//"))
 			{
-				Triangle tr;
-				sscanf_s(buf, "%lu//%lu", &v, &n);
-				tr.m_coords[0] = 0; tr.m_coords[1] = 0; tr.m_coords[2] = 0;
-				tr.m_vertex[0] = v-1; tr.m_normal[0] = n - 1 + n_drift;
-				fscanf_s(file, "%lu//%lu", &v, &n);
-				tr.m_vertex[1] = v - 1; tr.m_normal[1] = n - 1 + n_drift;
-				fscanf_s(file, "%lu//%lu", &v, &n);
-				tr.m_vertex[2] = v - 1; tr.m_normal[2] = n - 1 + n_drift;
-				tr.m_gid = m_groups.size();
-				m_triangles.push_back(tr);
-				cur_group.m_length++;
+				sscanf_s(buf, "%llu//%llu", &v, &n);
+				tv[0] = v - 1; tn[0] = n - 1 + n_drift;
+				fscanf_s(file, "%llu//%llu", &v, &n);
+				tv[1] = v - 1; tn[1] = n - 1 + n_drift;
+				fscanf_s(file, "%llu//%llu", &v, &n);
+				tv[2] = v - 1; tn[2] = n - 1 + n_drift;
 			}
-			else if (sscanf_s(buf, "%lu/%lu/%lu", &v, &t, &n) == 3)
+			else if (sscanf_s(buf, "%llu/%llu/%llu", &v, &t, &n) == 3)
 			{
-				Triangle tr;
-				tr.m_vertex[0] = v - 1; tr.m_normal[0] = n - 1 + n_drift; tr.m_coords[0] = t - 1;
-				fscanf_s(file, "%lu/%lu/%lu", &v, &t, &n);
-				tr.m_vertex[1] = v - 1; tr.m_normal[1] = n - 1 + n_drift; tr.m_coords[1] = t - 1;
-				fscanf_s(file, "%lu/%lu/%lu", &v, &t, &n);
-				tr.m_vertex[2] = v - 1; tr.m_normal[2] = n - 1 + n_drift; tr.m_coords[2] = t - 1;
-				tr.m_gid = m_groups.size();
-				m_triangles.push_back(tr);
-				cur_group.m_length++;
+				tv[0] = v - 1; tn[0] = n - 1 + n_drift; tt[0] = t - 1;
+				fscanf_s(file, "%llu/%llu/%llu", &v, &t, &n);
+				tv[1] = v - 1; tn[1] = n - 1 + n_drift; tt[1] = t - 1;
+				fscanf_s(file, "%llu/%llu/%llu", &v, &t, &n);
+				tv[2] = v - 1; tn[2] = n - 1 + n_drift; tt[2] = t - 1;
 			}
-			else if (sscanf_s(buf, "%lu/%lu", &v, &t) == 2)
+			else if (sscanf_s(buf, "%llu/%llu", &v, &t) == 2)
 			{
-				Triangle tr;
-				tr.m_vertex[0] = v - 1; tr.m_coords[0] = t - 1;
-				fscanf_s(file, "%lu/%lu", &v, &t);
-				tr.m_vertex[1] = v - 1; tr.m_coords[1] = t - 1;
-				fscanf_s(file, "%lu/%lu", &v, &t);
-				tr.m_vertex[2] = v - 1; tr.m_coords[2] = t - 1;
-				// per-vertex normal is missing, compute a geometric one
-				glm::vec3 v0 = m_vertex_buffer[tr.m_vertex[0]];
-				glm::vec3 v1 = m_vertex_buffer[tr.m_vertex[1]];
-				glm::vec3 v2 = m_vertex_buffer[tr.m_vertex[2]];
-				glm::vec3 n = glm::normalize( glm::cross(v1 - v0, v2 - v0));
-				tr.m_normal[0] = tr.m_normal[1] = tr.m_normal[2] = (unsigned int) m_normal_buffer.size();
-				m_normal_buffer.push_back(n);
-				n_drift++;
-				tr.m_gid = m_groups.size();
-				m_triangles.push_back(tr);
-				cur_group.m_length++;
+				tv[0] = v - 1; tt[0] = t - 1;
+				fscanf_s(file, "%llu/%llu", &v, &t);
+				tv[1] = v - 1; tt[1] = t - 1;
+				fscanf_s(file, "%llu/%llu", &v, &t);
+				tv[2] = v - 1; tt[2] = t - 1;
+				face_normal = true;
 			}
 			else
 			{
-				Triangle tr;
-				sscanf_s(buf, "%lu", &v);
-				tr.m_vertex[0] = v - 1;
-				sscanf_s(buf, "%lu", &v);
-				tr.m_vertex[1] = v - 1;
-				sscanf_s(buf, "%lu", &v);
-				tr.m_vertex[2] = v - 1;
-				// per-vertex normal is missing, compute a geometric one
-				glm::vec3 v0 = m_vertex_buffer[tr.m_vertex[0]];
-				glm::vec3 v1 = m_vertex_buffer[tr.m_vertex[1]];
-				glm::vec3 v2 = m_vertex_buffer[tr.m_vertex[2]];
+				sscanf_s(buf, "%llu", &v);
+				tv[0] = v - 1;
+				fscanf_s(file, "%llu", &v);
+				tv[1] = v - 1;
+				fscanf_s(file, "%llu", &v);
+				tv[2] = v - 1;
+				face_normal = true;
+			}
+			// per-vertex normal is missing, compute a geometric one
+			if (smooth_normals)
+				missing_normals.push_back(face_normal ? 1 : 0);
+			else if (face_normal && load_normals)
+			{
+				glm::vec3 v0 = m_vertex_buffer[tv[0]];
+				glm::vec3 v1 = m_vertex_buffer[tv[1]];
+				glm::vec3 v2 = m_vertex_buffer[tv[2]];
 				glm::vec3 n = glm::normalize(glm::cross(v1 - v0, v2 - v0));
-				tr.m_normal[0] = tr.m_normal[1] = tr.m_normal[2] = (unsigned int) m_normal_buffer.size();
+				tn[0] = tn[1] = tn[2] = m_normal_buffer.size();
 				m_normal_buffer.push_back(n);
 				n_drift++;
-				tr.m_coords[0] = 0; tr.m_coords[1] = 0; tr.m_coords[2] = 0;
-				tr.m_gid = m_groups.size();
-				m_triangles.push_back(tr);
-				cur_group.m_length++;
 			}
+			for (int k = 0; k < 3; k++)
+			{
+				m_vertex_indices.push_back(tv[k]);
+				if (load_normals)
+					m_normal_indices.push_back(tn[k]);
+				if (load_coords)
+					m_coords_indices.push_back(tt[k]);
+			}
+			m_triangle_groups.push_back((int)m_groups.size());
+			cur_group.m_length++;
 			break;
+		}
 		default:
 			fgets(buf, sizeof(buf), file);
 		}
@@ -325,169 +405,1008 @@ bool Mesh::readobj(std::string filename)
 		m_coords_buffer.push_back(glm::vec3(0.0f,0.0f, 0.0f));
 	}
 	fclose(file);
+	computeMetrics();
+	if (smooth_normals && std::find(missing_normals.begin(), missing_normals.end(), 1) != missing_normals.end())
+		computeSmoothNormals(missing_normals, crease_angle);
 	m_vertex_buffer.shrink_to_fit();
 	m_coords_buffer.shrink_to_fit();
 	m_normal_buffer.shrink_to_fit();
-	m_triangles.shrink_to_fit();
-	computeMetrics();
+	// index arrays identical to the vertex indices are not stored
+	if (m_normal_buffer.empty() || m_normal_indices == m_vertex_indices)
+		m_normal_indices.clear();
+	if (m_coords_indices == m_vertex_indices)
+		m_coords_indices.clear();
+	m_vertex_indices.shrink_to_fit();
+	m_normal_indices.shrink_to_fit();
+	m_coords_indices.shrink_to_fit();
+	m_triangle_groups.shrink_to_fit();
 	return true;
 }
 
+void Mesh::computeSmoothNormals(const std::vector<unsigned char>& missing, float crease_angle)
+{
+	long long n = (long long)getNumTriangles();
+	long long num_vertices = (long long)m_vertex_buffer.size();
+	float min_cos = cosf(glm::radians(crease_angle));
+
+	// corners around each vertex, from first[v] to first[v + 1]
+	std::vector<uint64_t> first(num_vertices + 1, 0);
+	for (long long c = 0; c < 3 * n; c++)
+		first[m_vertex_indices[c] + 1]++;
+	for (long long v = 0; v < num_vertices; v++)
+		first[v + 1] += first[v];
+	std::vector<uint64_t> corners(3 * n);
+	{
+		std::vector<uint64_t> next(first.begin(), first.end() - 1);
+		for (long long c = 0; c < 3 * n; c++)
+			corners[next[m_vertex_indices[c]]++] = c;
+	}
+
+	// face normals are weighted by the angle of the triangles at the vertex
+	std::vector<float> angles(3 * n);
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			glm::vec3 v0 = m_vertex_buffer[m_vertex_indices[3 * i + k]];
+			glm::vec3 e1 = m_vertex_buffer[m_vertex_indices[3 * i + (k + 1) % 3]] - v0;
+			glm::vec3 e2 = m_vertex_buffer[m_vertex_indices[3 * i + (k + 2) % 3]] - v0;
+			float lengths = glm::length(e1) * glm::length(e2);
+			angles[3 * i + k] = lengths > 0.0f ? acosf(glm::clamp(glm::dot(e1, e2) / lengths, -1.0f, 1.0f)) : 0.0f;
+		}
+	}
+
+	// each corner missing a normal averages the faces around its vertex within the crease angle
+	// of its own face; corners getting the same normal share it, so that smooth vertices have one
+	std::vector<glm::vec3> corner_normals(3 * n);
+	std::vector<uint32_t> local(3 * n);    // index of the normal among those of the vertex
+	std::vector<uint64_t> offsets(num_vertices + 1, 0);
+#pragma omp parallel
+	{
+		std::vector<uint64_t> order;       // missing corners of the vertex, sorted by normal
+		std::vector<uint64_t> leaders;     // first corner of each distinct normal
+#pragma omp for schedule(dynamic, 4096)
+		for (long long v = 0; v < num_vertices; v++)
+		{
+			order.clear();
+			for (uint64_t a = first[v]; a < first[v + 1]; a++)
+			{
+				uint64_t c = corners[a];
+				if (!missing[c / 3])
+					continue;
+				glm::vec3 face_normal = m_face_normals[c / 3];
+				glm::vec3 normal(0.0f);
+				for (uint64_t b = first[v]; b < first[v + 1]; b++)
+				{
+					uint64_t d = corners[b];
+					if (m_triangle_areas[d / 3] > 0.0f && glm::dot(face_normal, m_face_normals[d / 3]) >= min_cos)
+						normal += angles[d] * m_face_normals[d / 3];
+				}
+				float length = glm::length(normal);
+				corner_normals[c] = length > 0.0f ? normal / length : face_normal;
+				order.push_back(c);
+			}
+
+			// equal normals end up next to each other, each run led by its first corner around the
+			// vertex; the runs are numbered in the order of their leaders
+			std::sort(order.begin(), order.end(), [&](uint64_t c, uint64_t d)
+			{
+				int cmp = memcmp(&corner_normals[c], &corner_normals[d], sizeof(glm::vec3));
+				return cmp != 0 ? cmp < 0 : c < d;
+			});
+			leaders.clear();
+			for (size_t r = 0; r < order.size(); r++)
+				if (r == 0 || memcmp(&corner_normals[order[r - 1]], &corner_normals[order[r]], sizeof(glm::vec3)) != 0)
+					leaders.push_back(order[r]);
+			std::sort(leaders.begin(), leaders.end());
+			uint32_t distinct = (uint32_t)leaders.size();
+			for (uint32_t i = 0; i < distinct; i++)
+				local[leaders[i]] = i;
+			uint64_t leader = 0;
+			for (size_t r = 0; r < order.size(); r++)
+			{
+				if (r == 0 || memcmp(&corner_normals[order[r - 1]], &corner_normals[order[r]], sizeof(glm::vec3)) != 0)
+					leader = order[r];
+				local[order[r]] = local[leader];
+			}
+			offsets[v + 1] = distinct;
+		}
+	}
+	for (long long v = 0; v < num_vertices; v++)
+		offsets[v + 1] += offsets[v];
+
+	// the smooth normals follow the normals read from the file
+	uint64_t base = m_normal_buffer.size();
+	m_normal_buffer.resize(base + offsets[num_vertices]);
+	IndexBuffer normal_indices;
+	normal_indices.resize(3 * n, m_normal_buffer.size() - 1);
+#pragma omp parallel for
+	for (long long c = 0; c < 3 * n; c++)
+	{
+		if (!missing[c / 3])
+		{
+			normal_indices.set(c, m_normal_indices[c]);
+			continue;
+		}
+		uint64_t index = base + offsets[m_vertex_indices[c]] + local[c];
+		m_normal_buffer[index] = corner_normals[c];
+		normal_indices.set(c, index);
+	}
+	m_normal_indices.swap(normal_indices);
+}
+
+bool Mesh::readMapped(std::string filename, int attribs, bool reorder, bool weld, float crease_angle)
+{
+	MeshStoreHeader source;
+	source.m_attribs = attribs;
+	source.m_reordered = reorder ? 1 : 0;
+	source.m_welded = weld ? 1 : 0;
+	source.m_crease_angle = crease_angle < 0.0f ? -1.0f : crease_angle;
+	std::error_code error;
+	source.m_source_size = (uint64_t)std::filesystem::file_size(filename, error);
+	source.m_source_time = (uint64_t)std::filesystem::last_write_time(filename, error).time_since_epoch().count();
+	if (error)
+		return false;
+
+	std::string store = filename + ".msm";
+	if (mapStore(store, source))
+	{
+		m_filename = filename;
+		if (!m_mtl_filename.empty())
+			readMTL(directoryOf(filename) + m_mtl_filename, (attribs & MASK_COLORS) != 0);
+		return true;
+	}
+
+	// first use or modified OBJ file: parse it once and map the arrays from the new store
+	if (!readobj(filename, attribs, crease_angle))
+		return false;
+	if (weld)
+		this->weld();
+	if (reorder)
+		this->reorder();
+	if (!writeStore(store, source) || !mapStore(store, source))
+		printf("Could not write mesh store %s, keeping the mesh in memory\n", store.c_str());
+	return true;
+}
+
+bool Mesh::writeStore(const std::string& filename, MeshStoreHeader header) const
+{
+	FILE* file;
+	if (fopen_s(&file, filename.c_str(), "wb") != 0)
+		return false;
+
+	// groups and material library, appended after the arrays
+	std::string groups;
+	auto append = [&groups](const void* data, size_t size) { groups.append((const char*)data, size); };
+	uint64_t length = m_mtl_filename.size();
+	append(&length, sizeof(length));
+	append(m_mtl_filename.data(), m_mtl_filename.size());
+	for (const TriangleGroup& group : m_groups)
+	{
+		uint64_t range[2] = { group.m_start, group.m_length };
+		append(range, sizeof(range));
+		append(&group.m_classification, sizeof(group.m_classification));
+		length = group.matname.size();
+		append(&length, sizeof(length));
+		append(group.matname.data(), group.matname.size());
+	}
+
+	const void* data[STORE_ARRAYS] = { m_vertex_buffer.data(), m_normal_buffer.data(), m_coords_buffer.data(),
+		m_vertex_indices.data(), m_normal_indices.data(), m_coords_indices.data(),
+		m_triangle_areas.data(), m_triangle_groups.data(), m_face_normals.data() };
+	size_t bytes[STORE_ARRAYS] = { m_vertex_buffer.size() * sizeof(glm::vec3), m_normal_buffer.size() * sizeof(glm::vec3),
+		m_coords_buffer.size() * sizeof(glm::vec3), m_vertex_indices.bytes(), m_normal_indices.bytes(), m_coords_indices.bytes(),
+		m_triangle_areas.size() * sizeof(float), m_triangle_groups.size() * sizeof(int), m_face_normals.size() * sizeof(glm::vec3) };
+	header.m_count[STORE_VERTICES] = m_vertex_buffer.size();
+	header.m_count[STORE_NORMALS] = m_normal_buffer.size();
+	header.m_count[STORE_COORDS] = m_coords_buffer.size();
+	header.m_count[STORE_VERTEX_INDICES] = m_vertex_indices.size();
+	header.m_count[STORE_NORMAL_INDICES] = m_normal_indices.size();
+	header.m_count[STORE_COORDS_INDICES] = m_coords_indices.size();
+	header.m_count[STORE_AREAS] = m_triangle_areas.size();
+	header.m_count[STORE_GROUPS] = m_triangle_groups.size();
+	header.m_count[STORE_FACE_NORMALS] = m_face_normals.size();
+	header.m_wide = (m_vertex_indices.isWide() ? 1 : 0) | (m_normal_indices.isWide() ? 2 : 0) | (m_coords_indices.isWide() ? 4 : 0);
+	header.m_area = m_area;
+	for (int k = 0; k < 3; k++)
+	{
+		header.m_min[k] = m_min[k];
+		header.m_max[k] = m_max[k];
+	}
+	uint64_t offset = sizeof(header);
+	for (int a = 0; a < STORE_ARRAYS; a++)
+	{
+		offset = (offset + MESH_STORE_ALIGNMENT - 1) / MESH_STORE_ALIGNMENT * MESH_STORE_ALIGNMENT;
+		header.m_offset[a] = offset;
+		offset += bytes[a];
+	}
+	header.m_groups_offset = offset;
+	header.m_groups_size = groups.size();
+
+	static const char padding[MESH_STORE_ALIGNMENT] = {};
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	uint64_t position = sizeof(header);
+	for (int a = 0; a < STORE_ARRAYS && ok; a++)
+	{
+		ok = fwrite(padding, 1, header.m_offset[a] - position, file) == header.m_offset[a] - position &&
+			fwrite(data[a], 1, bytes[a], file) == bytes[a];
+		position = header.m_offset[a] + bytes[a];
+	}
+	ok = ok && fwrite(groups.data(), 1, groups.size(), file) == groups.size();
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+		std::remove(filename.c_str());
+	return ok;
+}
+
+bool Mesh::mapStore(const std::string& filename, const MeshStoreHeader& source)
+{
+	MappedFile store;
+	// copy on write, the arrays may be modified in place
+	if (!store.open(filename, true) || store.size() < sizeof(MeshStoreHeader))
+		return false;
+	MeshStoreHeader header;
+	memcpy(&header, store.data(), sizeof(header));
+	bool normals = (source.m_attribs & MASK_NORMALS) != 0, coords = (source.m_attribs & MASK_COLORS) != 0;
+	if (memcmp(header.m_magic, source.m_magic, 4) != 0 || header.m_version != MESH_STORE_VERSION ||
+		header.m_source_size != source.m_source_size || header.m_source_time != source.m_source_time ||
+		(header.m_attribs & source.m_attribs) != source.m_attribs || header.m_reordered < source.m_reordered ||
+		header.m_welded != source.m_welded ||
+		(normals && header.m_crease_angle != source.m_crease_angle) ||
+		header.m_groups_offset > store.size() || header.m_groups_size > store.size() - header.m_groups_offset)
+		return false;
+	// the extents are compared without computing offset + count * element, which may overflow
+	size_t element[STORE_ARRAYS] = { sizeof(glm::vec3), sizeof(glm::vec3), sizeof(glm::vec3),
+		(header.m_wide & 1) ? sizeof(uint64_t) : sizeof(uint32_t), (header.m_wide & 2) ? sizeof(uint64_t) : sizeof(uint32_t),
+		(header.m_wide & 4) ? sizeof(uint64_t) : sizeof(uint32_t), sizeof(float), sizeof(int), sizeof(glm::vec3) };
+	for (int a = 0; a < STORE_ARRAYS; a++)
+		if (header.m_offset[a] > header.m_groups_offset || header.m_count[a] > (header.m_groups_offset - header.m_offset[a]) / element[a])
+			return false;
+	// the per-corner and per-triangle arrays must agree on the number of triangles
+	uint64_t corners = header.m_count[STORE_VERTEX_INDICES], triangles = corners / 3;
+	if (corners % 3 != 0 ||
+		(header.m_count[STORE_NORMAL_INDICES] != 0 && header.m_count[STORE_NORMAL_INDICES] != corners) ||
+		(header.m_count[STORE_COORDS_INDICES] != 0 && header.m_count[STORE_COORDS_INDICES] != corners) ||
+		header.m_count[STORE_AREAS] != triangles || header.m_count[STORE_GROUPS] != triangles ||
+		header.m_count[STORE_FACE_NORMALS] != triangles)
+		return false;
+
+	// groups and material library
+	const unsigned char* groups = store.data() + header.m_groups_offset;
+	const unsigned char* groups_end = groups + header.m_groups_size;
+	auto read = [&groups, groups_end](void* data, size_t size)
+	{
+		if (groups + size > groups_end)
+			return false;
+		memcpy(data, groups, size);
+		groups += size;
+		return true;
+	};
+	uint64_t length;
+	if (!read(&length, sizeof(length)) || length > (uint64_t)(groups_end - groups))
+		return false;
+	m_mtl_filename.assign((const char*)groups, length);
+	groups += length;
+	m_groups.clear();
+	while (groups < groups_end)
+	{
+		TriangleGroup group;
+		uint64_t range[2];
+		if (!read(range, sizeof(range)) || !read(&group.m_classification, sizeof(group.m_classification)) ||
+			!read(&length, sizeof(length)) || length > (uint64_t)(groups_end - groups) ||
+			range[0] > triangles || range[1] > triangles - range[0])
+			return false;
+		group.m_start = range[0];
+		group.m_length = range[1];
+		group.matname.assign((const char*)groups, length);
+		groups += length;
+		m_groups.push_back(group);
+	}
+
+	// the attributes that are not needed are left out, as readobj does
+	const unsigned char* base = store.data();
+	m_vertex_buffer.map(base + header.m_offset[STORE_VERTICES], header.m_count[STORE_VERTICES]);
+	m_vertex_indices.map(base + header.m_offset[STORE_VERTEX_INDICES], header.m_count[STORE_VERTEX_INDICES], (header.m_wide & 1) != 0);
+	if (normals)
+	{
+		m_normal_buffer.map(base + header.m_offset[STORE_NORMALS], header.m_count[STORE_NORMALS]);
+		m_normal_indices.map(base + header.m_offset[STORE_NORMAL_INDICES], header.m_count[STORE_NORMAL_INDICES], (header.m_wide & 2) != 0);
+	}
+	else
+	{
+		m_normal_buffer.clear();
+		m_normal_indices.clear();
+	}
+	if (coords)
+	{
+		m_coords_buffer.map(base + header.m_offset[STORE_COORDS], header.m_count[STORE_COORDS]);
+		m_coords_indices.map(base + header.m_offset[STORE_COORDS_INDICES], header.m_count[STORE_COORDS_INDICES], (header.m_wide & 4) != 0);
+	}
+	else
+	{
+		m_coords_buffer.clear();
+		m_coords_buffer.push_back(glm::vec3(0.0f, 0.0f, 0.0f));
+		m_coords_indices.clear();
+	}
+	m_triangle_areas.map(base + header.m_offset[STORE_AREAS], header.m_count[STORE_AREAS]);
+	m_triangle_groups.map(base + header.m_offset[STORE_GROUPS], header.m_count[STORE_GROUPS]);
+	m_face_normals.map(base + header.m_offset[STORE_FACE_NORMALS], header.m_count[STORE_FACE_NORMALS]);
+	m_area = header.m_area;
+	m_min = glm::vec3(header.m_min[0], header.m_min[1], header.m_min[2]);
+	m_max = glm::vec3(header.m_max[0], header.m_max[1], header.m_max[2]);
+	m_store.swap(store);
+	return true;
+}
+
+void Mesh::adviseAccess(int advice)
+{
+	if (!m_store.isOpen())
+		return;
+	m_store.advise(m_store.data(), m_store.size(), advice);
+}
+
+void Mesh::prefetchTriangles(size_t first, size_t count)
+{
+	if (!m_store.isOpen() || first >= getNumTriangles())
+		return;
+	count = std::min(count, getNumTriangles() - first);
+	const IndexBuffer* indices[3] = { &m_vertex_indices, &m_normal_indices, &m_coords_indices };
+	for (const IndexBuffer* index : indices)
+	{
+		if (index->isMapped() && !index->empty())
+		{
+			size_t bytes = (index->isWide() ? sizeof(uint64_t) : sizeof(uint32_t)) * 3;
+			m_store.advise((const unsigned char*)index->data() + first * bytes, count * bytes, MAPPED_ADVICE_WILLNEED);
+		}
+	}
+	if (m_triangle_areas.isMapped())
+		m_store.advise(&m_triangle_areas[first], count * sizeof(float), MAPPED_ADVICE_WILLNEED);
+	if (m_triangle_groups.isMapped())
+		m_store.advise(&m_triangle_groups[first], count * sizeof(int), MAPPED_ADVICE_WILLNEED);
+	if (m_face_normals.isMapped())
+		m_store.advise(&m_face_normals[first], count * sizeof(glm::vec3), MAPPED_ADVICE_WILLNEED);
+}
+
+// sorts the range: blocks are sorted by the threads, then merged pairwise, level by level
+template <typename T>
+static void parallelSort(T* first, T* last)
+{
+	long long n = last - first;
+	int blocks = omp_get_max_threads();
+	if (n < 65536 || blocks == 1)
+	{
+		std::sort(first, last);
+		return;
+	}
+	std::vector<long long> bounds(blocks + 1);
+	for (int b = 0; b <= blocks; b++)
+		bounds[b] = n * b / blocks;
+#pragma omp parallel for
+	for (int b = 0; b < blocks; b++)
+		std::sort(first + bounds[b], first + bounds[b + 1]);
+	for (int width = 1; width < blocks; width *= 2)
+	{
+#pragma omp parallel for
+		for (int b = 0; b < blocks; b += 2 * width)
+		{
+			if (b + width < blocks)
+				std::inplace_merge(first + bounds[b], first + bounds[b + width], first + bounds[std::min(b + 2 * width, blocks)]);
+		}
+	}
+}
+
+// renumbers the elements of the buffers indexed by indices in order of first use, unused ones last
+static void renumber(IndexBuffer& indices, std::vector<MeshArray<glm::vec3>*> buffers)
+{
+	size_t count = buffers[0]->size();
+	std::vector<uint64_t> map(count, UINT64_MAX);
+	uint64_t next = 0;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		if (map[indices[i]] == UINT64_MAX)
+			map[indices[i]] = next++;
+	}
+	for (size_t k = 0; k < count; k++)
+	{
+		if (map[k] == UINT64_MAX)
+			map[k] = next++;
+	}
+
+	long long n = (long long)indices.size();
+	IndexBuffer renumbered;
+	renumbered.resize(n, indices.isWide() ? UINT64_MAX : 0);
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++)
+		renumbered.set(i, map[indices[i]]);
+	indices.swap(renumbered);
+	for (MeshArray<glm::vec3>* buffer : buffers)
+	{
+		MeshArray<glm::vec3> result;
+		result.resize(count);
+#pragma omp parallel for
+		for (long long k = 0; k < (long long)count; k++)
+			result[map[k]] = (*buffer)[k];
+		buffer->swap(result);
+	}
+}
+
+void Mesh::reorder()
+{
+	long long n = (long long)getNumTriangles();
+	if (n == 0)
+		return;
+
+	// Morton code of the centroids in the bounding box, the triangle index breaks ties
+	glm::vec3 extent = glm::max(m_max - m_min, glm::vec3(1.0e-30f));
+	std::vector<std::pair<uint64_t, uint64_t>> order(n);
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++)
+	{
+		glm::vec3 centroid = (m_vertex_buffer[m_vertex_indices[3 * i + 0]] + m_vertex_buffer[m_vertex_indices[3 * i + 1]] +
+			m_vertex_buffer[m_vertex_indices[3 * i + 2]]) / 3.0f;
+		glm::vec3 p = (centroid - m_min) / extent;
+		order[i] = std::make_pair(mortonCode3D(p.x, p.y, p.z), (uint64_t)i);
+	}
+	// triangles stay within their group, so that the group ranges remain valid
+	for (const TriangleGroup& group : m_groups)
+		parallelSort(order.data() + group.m_start, order.data() + group.m_start + group.m_length);
+
+	auto permuteIndices = [&](IndexBuffer& indices)
+	{
+		if (indices.empty())
+			return;
+		IndexBuffer permuted;
+		permuted.resize(3 * n, indices.isWide() ? UINT64_MAX : 0);
+#pragma omp parallel for
+		for (long long i = 0; i < n; i++)
+		{
+			for (int k = 0; k < 3; k++)
+				permuted.set(3 * i + k, indices[3 * order[i].second + k]);
+		}
+		indices.swap(permuted);
+	};
+	auto permute = [&](auto& array)
+	{
+		typename std::remove_reference<decltype(array)>::type permuted;
+		permuted.resize(n);
+#pragma omp parallel for
+		for (long long i = 0; i < n; i++)
+			permuted[i] = array[order[i].second];
+		array.swap(permuted);
+	};
+	permuteIndices(m_vertex_indices);
+	permuteIndices(m_normal_indices);
+	permuteIndices(m_coords_indices);
+	permute(m_triangle_areas);
+	permute(m_triangle_groups);
+	permute(m_face_normals);
+
+	// attributes sharing the vertex indices are renumbered along with the vertices; an attribute
+	// buffer of another size gets its own indices first
+	std::vector<MeshArray<glm::vec3>*> shared = { &m_vertex_buffer };
+	MeshArray<glm::vec3>* attributes[2] = { &m_normal_buffer, &m_coords_buffer };
+	IndexBuffer* attribute_indices[2] = { &m_normal_indices, &m_coords_indices };
+	for (int a = 0; a < 2; a++)
+	{
+		// coordinates that were not loaded are a single dummy pair
+		if (attributes[a]->empty() || (a == 1 && attributes[a]->size() == 1 && attribute_indices[a]->empty()))
+			continue;
+		if (attribute_indices[a]->empty() && attributes[a]->size() == m_vertex_buffer.size())
+			shared.push_back(attributes[a]);
+		else
+		{
+			if (attribute_indices[a]->empty())
+				*attribute_indices[a] = m_vertex_indices;
+			renumber(*attribute_indices[a], { attributes[a] });
+		}
+	}
+	renumber(m_vertex_indices, shared);
+}
+
+// maps each of count items to the first item equal to it. Items are grouped by hash with a
+// parallel sort, then the runs of equal hashes are compared in parallel.
+template <typename Hash, typename Equal>
+static std::vector<uint64_t> firstEquals(long long count, Hash hash, Equal equal)
+{
+	std::vector<std::pair<uint64_t, uint64_t>> order(count);
+#pragma omp parallel for
+	for (long long i = 0; i < count; i++)
+		order[i] = std::make_pair(hash(i), (uint64_t)i);
+	parallelSort(order.data(), order.data() + count);
+
+	std::vector<long long> runs;
+	for (long long i = 0; i < count; i++)
+	{
+		if (i == 0 || order[i].first != order[i - 1].first)
+			runs.push_back(i);
+	}
+	runs.push_back(count);
+	std::vector<uint64_t> first(count);
+	long long num_runs = (long long)runs.size() - 1;
+#pragma omp parallel for schedule(dynamic, 1024)
+	for (long long r = 0; r < num_runs; r++)
+	{
+		// items of a run are in increasing order, so the first of equal items is met first
+		std::vector<uint64_t> distinct;
+		for (long long i = runs[r]; i < runs[r + 1]; i++)
+		{
+			uint64_t item = order[i].second;
+			first[item] = item;
+			for (uint64_t other : distinct)
+			{
+				if (equal(other, item))
+				{
+					first[item] = other;
+					break;
+				}
+			}
+			if (first[item] == item && runs[r + 1] - runs[r] > 1)
+				distinct.push_back(item);
+		}
+	}
+	return first;
+}
+
+void Mesh::weld()
+{
+	long long n = (long long)getNumTriangles();
+	long long num_vertices = (long long)m_vertex_buffer.size();
+	if (n == 0)
+		return;
+
+	// attributes sharing the vertex indices are welded along with the positions; an attribute
+	// buffer of another size gets its own indices
+	std::vector<MeshArray<glm::vec3>*> shared = { &m_vertex_buffer };
+	MeshArray<glm::vec3>* attributes[2] = { &m_normal_buffer, &m_coords_buffer };
+	IndexBuffer* attribute_indices[2] = { &m_normal_indices, &m_coords_indices };
+	for (int a = 0; a < 2; a++)
+	{
+		// coordinates that were not loaded are a single dummy pair
+		if (attributes[a]->empty() || !attribute_indices[a]->empty() || (a == 1 && attributes[a]->size() == 1))
+			continue;
+		if (attributes[a]->size() == m_vertex_buffer.size())
+			shared.push_back(attributes[a]);
+		else
+			*attribute_indices[a] = m_vertex_indices;
+	}
+
+	// identical vertices, compared bitwise
+	auto hashVertex = [&](const std::vector<MeshArray<glm::vec3>*>& buffers, long long v)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (MeshArray<glm::vec3>* buffer : buffers)
+			hash = hashBytes(&(*buffer)[v], sizeof(glm::vec3), hash);
+		return hash;
+	};
+	auto equalVertex = [&](const std::vector<MeshArray<glm::vec3>*>& buffers, uint64_t u, uint64_t v)
+	{
+		for (MeshArray<glm::vec3>* buffer : buffers)
+		{
+			if (memcmp(&(*buffer)[u], &(*buffer)[v], sizeof(glm::vec3)) != 0)
+				return false;
+		}
+		return true;
+	};
+	std::vector<MeshArray<glm::vec3>*> positions = { &m_vertex_buffer };
+	std::vector<uint64_t> welded = firstEquals(num_vertices, [&](long long v) { return hashVertex(shared, v); },
+		[&](uint64_t u, uint64_t v) { return equalVertex(shared, u, v); });
+	// triangles are compared by position only, duplicates differing in their attributes are removed too
+	std::vector<uint64_t> same_position = shared.size() == 1 ? welded : firstEquals(num_vertices,
+		[&](long long v) { return hashVertex(positions, v); }, [&](uint64_t u, uint64_t v) { return equalVertex(positions, u, v); });
+
+	std::vector<std::array<uint64_t, 3>> corners(n);
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++)
+	{
+		for (int k = 0; k < 3; k++)
+			corners[i][k] = same_position[m_vertex_indices[3 * i + k]];
+		std::sort(corners[i].begin(), corners[i].end());
+	}
+	std::vector<uint64_t> first_triangle = firstEquals(n, [&](long long i) { return hashBytes(corners[i].data(), sizeof(corners[i])); },
+		[&](uint64_t i, uint64_t j) { return corners[i] == corners[j]; });
+
+	// new position of each kept triangle
+	std::vector<uint64_t> kept(n + 1);
+	size_t duplicates = 0, degenerates = 0;
+	for (long long i = 0; i < n; i++)
+	{
+		bool degenerate = corners[i][0] == corners[i][1] || corners[i][1] == corners[i][2] || m_triangle_areas[i] == 0.0f;
+		bool duplicate = !degenerate && first_triangle[i] != (uint64_t)i;
+		kept[i + 1] = kept[i] + (degenerate || duplicate ? 0 : 1);
+		degenerates += degenerate ? 1 : 0;
+		duplicates += duplicate ? 1 : 0;
+	}
+	std::vector<std::array<uint64_t, 3>>().swap(corners);
+	long long num_kept = (long long)kept[n];
+
+	// welded vertices used by the kept triangles, numbered in order
+	std::vector<unsigned char> used(num_vertices, 0);
+	for (long long i = 0; i < n; i++)
+	{
+		if (kept[i + 1] != kept[i])
+		{
+			for (int k = 0; k < 3; k++)
+				used[welded[m_vertex_indices[3 * i + k]]] = 1;
+		}
+	}
+	std::vector<uint64_t> renumbered(num_vertices);
+	uint64_t num_used = 0;
+	for (long long v = 0; v < num_vertices; v++)
+	{
+		if (used[v])
+			renumbered[v] = num_used++;
+	}
+	for (MeshArray<glm::vec3>* buffer : shared)
+	{
+		MeshArray<glm::vec3> compacted;
+		compacted.resize(num_used);
+#pragma omp parallel for
+		for (long long v = 0; v < num_vertices; v++)
+		{
+			if (used[v])
+				compacted[renumbered[v]] = (*buffer)[v];
+		}
+		buffer->swap(compacted);
+	}
+
+	auto compact = [&](IndexBuffer& indices, bool remap)
+	{
+		if (indices.empty())
+			return;
+		IndexBuffer compacted;
+		compacted.resize(3 * num_kept, remap ? (num_used > 0 ? num_used - 1 : 0) : (indices.isWide() ? UINT64_MAX : 0));
+#pragma omp parallel for
+		for (long long i = 0; i < n; i++)
+		{
+			if (kept[i + 1] == kept[i])
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				uint64_t index = indices[3 * i + k];
+				compacted.set(3 * kept[i] + k, remap ? renumbered[welded[index]] : index);
+			}
+		}
+		indices.swap(compacted);
+	};
+	compact(m_normal_indices, false);
+	compact(m_coords_indices, false);
+	compact(m_vertex_indices, true);
+	MeshArray<int> triangle_groups;
+	triangle_groups.resize(num_kept);
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++)
+	{
+		if (kept[i + 1] != kept[i])
+			triangle_groups[kept[i]] = m_triangle_groups[i];
+	}
+	m_triangle_groups.swap(triangle_groups);
+	for (TriangleGroup& group : m_groups)
+	{
+		size_t end = group.m_start + group.m_length;
+		group.m_start = kept[group.m_start];
+		group.m_length = kept[end] - group.m_start;
+	}
+	if (m_normal_indices == m_vertex_indices)
+		m_normal_indices.clear();
+	if (m_coords_indices == m_vertex_indices)
+		m_coords_indices.clear();
+	computeMetrics();
+
+	printf("Welded %lld vertices into %llu, removed %zu duplicate and %zu degenerate triangles\n",
+		num_vertices, (unsigned long long)num_used, duplicates, degenerates);
+}
+
 void Mesh::flatten()
 {
-	// make an equally-sized buffer for all attributes.
-	unsigned int total_verts = m_triangles.size() * 3;
-	glm::vec3 * vertices = new glm::vec3[total_verts];
-	glm::vec3 * normals = new glm::vec3[total_verts];
-	glm::vec3 * texcoords = new glm::vec3[total_verts]; // third coord is the group id (as float).
-	unsigned int index = 0;
-	unsigned int gid = 0;
-	for (auto g : m_groups)
-	{
-		for (int i = g.m_start; i<g.m_start + g.m_length; i++)
-		{
-			Triangle & tr = m_triangles[i];
-			vertices[index + 0] = m_vertex_buffer[tr.m_vertex[0]];
-			vertices[index + 1] = m_vertex_buffer[tr.m_vertex[1]];
-			vertices[index + 2] = m_vertex_buffer[tr.m_vertex[2]];
-			normals[index + 0] = m_normal_buffer[tr.m_normal[0]];
-			normals[index + 1] = m_normal_buffer[tr.m_normal[1]];
-			normals[index + 2] = m_normal_buffer[tr.m_normal[2]];
-			texcoords[index + 0].x = m_coords_buffer[tr.m_coords[0]].x;
-			texcoords[index + 0].y = m_coords_buffer[tr.m_coords[0]].y;
-			texcoords[index + 0].z = gid;
-			texcoords[index + 1].x = m_coords_buffer[tr.m_coords[1]].x;
-			texcoords[index + 1].y = m_coords_buffer[tr.m_coords[1]].y;
-			texcoords[index + 1].z = gid;
-			texcoords[index + 2].x = m_coords_buffer[tr.m_coords[2]].x;
-			texcoords[index + 2].y = m_coords_buffer[tr.m_coords[2]].y;
-			texcoords[index + 2].z = gid;
-
-			tr.m_vertex[0] = index + 0;
-			tr.m_vertex[1] = index + 1;
-			tr.m_vertex[2] = index + 2;
-			tr.m_normal[0] = index + 0;
-			tr.m_normal[1] = index + 1;
-			tr.m_normal[2] = index + 2;
-			tr.m_coords[0] = index + 0;
-			tr.m_coords[1] = index + 1;
-			tr.m_coords[2] = index + 2;
-
-			tr.m_face_normal = glm::cross(vertices[index + 1] - vertices[index + 0], vertices[index + 2] - vertices[index + 0]);
-			tr.m_area = glm::length(tr.m_face_normal)*0.5f;
-			tr.m_face_normal = glm::normalize(tr.m_face_normal);
-			tr.m_gid = gid;
-
-			index += 3;
-		}
-		gid++;
-	}
-	m_vertex_buffer.resize(total_verts);
-	memcpy(&(m_vertex_buffer[0]), vertices, total_verts * sizeof(glm::vec3));
-
-	m_normal_buffer.resize(total_verts);
-	memcpy(&(m_normal_buffer[0]), normals, total_verts * sizeof(glm::vec3));
-
-	m_coords_buffer.resize(total_verts);
-	memcpy(&(m_coords_buffer[0]), texcoords, total_verts * sizeof(glm::vec3));
+	// each group is laid out after the previous ones, its output offset is the prefix sum of their lengths
+	std::vector<size_t> offsets(m_groups.size() + 1, 0);
+	for (size_t g = 0; g < m_groups.size(); g++)
+		offsets[g + 1] = offsets[g] + m_groups[g].m_length;
+	size_t total_verts = offsets.back() * 3;
+
+	// fills buffer with attribute(triangle, corner, group) of the flattened vertices in parallel.
+	// The source buffer is released before the next attribute is flattened, so that a single
+	// attribute is held twice at any time.
+	auto flattenAttribute = [&](MeshArray<glm::vec3>& buffer, auto attribute)
+	{
+		MeshArray<glm::vec3> flat;
+		flat.resize(total_verts);
+		for (size_t g = 0; g < m_groups.size(); g++)
+		{
+			long long start = (long long)m_groups[g].m_start;
+			long long length = (long long)m_groups[g].m_length;
+			glm::vec3* out = flat.data() + 3 * offsets[g];
+#pragma omp parallel for
+			for (long long i = 0; i < length; i++)
+			{
+				for (int k = 0; k < 3; k++)
+					out[3 * i + k] = attribute(start + i, k, (int)g);
+			}
+		}
+		buffer.swap(flat);
+	};
+
+	// normals first, while the face normals are those of the source triangles
+	bool face_normals = m_normal_buffer.empty();
+	flattenAttribute(m_normal_buffer, [&](size_t i, int k, int)
+	{
+		return face_normals ? m_face_normals[i] : m_normal_buffer[getNormalIndex(i, k)];
+	});
+	m_normal_indices.clear();
+	// third coord is the group id (as float). Coordinates that were not loaded are a single dummy pair.
+	bool dummy_coords = m_coords_indices.empty() && m_coords_buffer.size() == 1;
+	flattenAttribute(m_coords_buffer, [&](size_t i, int k, int g)
+	{
+		const glm::vec3& coords = m_coords_buffer[dummy_coords ? 0 : getCoordsIndex(i, k)];
+		return glm::vec3(coords.x, coords.y, (float)g);
+	});
+	m_coords_indices.clear();
+	flattenAttribute(m_vertex_buffer, [&](size_t i, int k, int)
+	{
+		return m_vertex_buffer[m_vertex_indices[3 * i + k]];
+	});
 
 	m_color_buffer.resize(total_verts, glm::vec3(1.0f, 1.0f, 1.0f));
 
-	m_area = 0.0f;
-	for (auto tr : m_triangles)
-		m_area += tr.m_area;
-	m_area_cdf.resize(m_triangles.size());
-	m_area_cdf[0] = m_triangles[0].m_area / m_area;
-	for (size_t i = 1; i < m_triangles.size(); i++)
+	// all attributes now share the vertex indices
+	m_vertex_indices.resize(total_verts, total_verts > 0 ? total_verts - 1 : 0);
+	m_triangle_groups.resize(total_verts / 3);
+	for (size_t g = 0; g < m_groups.size(); g++)
 	{
-		m_area_cdf[i] = m_area_cdf[i-1] + m_triangles[i].m_area / m_area;
+		long long first = (long long)offsets[g];
+		long long last = (long long)offsets[g + 1];
+#pragma omp parallel for
+		for (long long i = first; i < last; i++)
+		{
+			for (int k = 0; k < 3; k++)
+				m_vertex_indices.set(3 * i + k, 3 * i + k);
+			m_triangle_groups[i] = (int)g;
+		}
+		m_groups[g].m_start = offsets[g];
 	}
 
-	delete[] vertices;
-	delete[] normals;
-	delete[] texcoords;
+	computeMetrics();
+	computeAreaCDF();
+}
+
+void Mesh::quantize(int bits)
+{
+	size_t before = (m_vertex_buffer.size() + m_normal_buffer.size()) * sizeof(glm::vec3);
+	m_quantized_vertices.build(m_vertex_buffer.data(), m_vertex_buffer.size(), bits);
+	m_vertex_buffer.clear();
+	if (!m_normal_buffer.empty())
+	{
+		m_quantized_normals.build(m_normal_buffer.data(), m_normal_buffer.size());
+		m_normal_buffer.clear();
+	}
+	size_t after = m_quantized_vertices.bytes() + m_quantized_normals.bytes();
+	printf("Quantized the vertices to %d bits: %.1f MB instead of %.1f MB\n", m_quantized_vertices.getBits(),
+		after / (1024.0 * 1024.0), before / (1024.0 * 1024.0));
 }
 
 void Mesh::computeMetrics()
 {
-	m_area = 0.0f;
+	long long n = (long long)getNumTriangles();
+	m_triangle_areas.resize(n);
+	m_face_normals.resize(n);
+	m_vertex_indices.visit([&](auto indices)
+	{
+		// accumulated in double, float sums stall past ~10^7 triangles
+		double area = 0.0;
+#pragma omp parallel for reduction(+:area)
+		for (long long i = 0; i < n; i++)
+		{
+			glm::vec3 v0 = m_vertex_buffer[indices[3 * i + 0]];
+			glm::vec3 face_normal = glm::cross(m_vertex_buffer[indices[3 * i + 1]] - v0,
+				                               m_vertex_buffer[indices[3 * i + 2]] - v0);
+			m_triangle_areas[i] = glm::length(face_normal) * 0.5f;
+			m_face_normals[i] = glm::normalize(face_normal);
+			area += m_triangle_areas[i];
+		}
+		m_area = (float)area;
+	});
+}
+
+void Mesh::computeAreaCDF()
+{
+	long long n = (long long)getNumTriangles();
+	m_area_cdf.resize(n);
+	if (n == 0)
+		return;
+
+	// parallel prefix sum in double: the blocks are summed, the block sums scanned and then
+	// each block is scanned from its offset. Fixed size blocks keep the result independent
+	// of the number of threads.
+	long long num_blocks = (n + AREA_CDF_BLOCK_SIZE - 1) / AREA_CDF_BLOCK_SIZE;
+	std::vector<double> offsets(num_blocks + 1, 0.0);
 #pragma omp parallel for
-	for (long i = 0; i < m_triangles.size(); i++)
+	for (long long b = 0; b < num_blocks; b++)
 	{
-		
-		Triangle& tr = m_triangles[i];
-		tr.m_face_normal = glm::cross(m_vertex_buffer[tr.m_vertex[1]] - m_vertex_buffer[tr.m_vertex[0]],
-			                          m_vertex_buffer[tr.m_vertex[2]] - m_vertex_buffer[tr.m_vertex[0]]);
-		tr.m_area = glm::length(tr.m_face_normal) * 0.5f;
-		tr.m_face_normal = glm::normalize(tr.m_face_normal);
+		long long end = std::min(n, (b + 1) * AREA_CDF_BLOCK_SIZE);
+		double sum = 0.0;
+		for (long long i = b * AREA_CDF_BLOCK_SIZE; i < end; i++)
+			sum += m_triangle_areas[i];
+		offsets[b + 1] = sum;
 	}
+	for (long long b = 0; b < num_blocks; b++)
+		offsets[b + 1] += offsets[b];
 
-	for (long i = 0; i < m_triangles.size(); i++)
+	double inv_total = 1.0 / offsets[num_blocks];
+#pragma omp parallel for
+	for (long long b = 0; b < num_blocks; b++)
 	{
-		m_area += m_triangles[i].m_area;
+		long long end = std::min(n, (b + 1) * AREA_CDF_BLOCK_SIZE);
+		double sum = offsets[b];
+		for (long long i = b * AREA_CDF_BLOCK_SIZE; i < end; i++)
+		{
+			sum += m_triangle_areas[i];
+			m_area_cdf[i] = sum * inv_total;
+		}
 	}
+	m_area_cdf[n - 1] = 1.0;
+}
 
+size_t Mesh::sampleTriangleByArea(double xsi) const
+{
+	auto iter = std::upper_bound(m_area_cdf.begin(), m_area_cdf.end(), xsi);
+	return std::min<size_t>(std::distance(m_area_cdf.begin(), iter), m_area_cdf.size() - 1);
 }
 
-glm::vec3 Mesh::sampleTrianglePosition(uint32_t trid, glm::vec3 uvw)
+void Mesh::buildBVH()
+{
+	long long n = (long long)getNumTriangles();
+	std::vector<glm::vec3> bmin(n), bmax(n);
+	m_vertex_indices.visit([&](auto indices)
+	{
+#pragma omp parallel for
+		for (long long i = 0; i < n; i++)
+		{
+			glm::vec3 v0 = m_vertex_buffer[indices[3 * i + 0]];
+			glm::vec3 v1 = m_vertex_buffer[indices[3 * i + 1]];
+			glm::vec3 v2 = m_vertex_buffer[indices[3 * i + 2]];
+			bmin[i] = glm::min(v0, glm::min(v1, v2));
+			bmax[i] = glm::max(v0, glm::max(v1, v2));
+		}
+	});
+	m_bvh.build(bmin, bmax);
+}
+
+glm::vec3 Mesh::sampleTrianglePosition(size_t trid, glm::vec3 uvw)
 {
 
-	glm::vec3 v0 = m_vertex_buffer[m_triangles[trid].m_vertex[0]];
-	glm::vec3 v1 = m_vertex_buffer[m_triangles[trid].m_vertex[1]];
-	glm::vec3 v2 = m_vertex_buffer[m_triangles[trid].m_vertex[2]];
+	glm::vec3 v0 = getVertex(m_vertex_indices[3 * trid + 0]);
+	glm::vec3 v1 = getVertex(m_vertex_indices[3 * trid + 1]);
+	glm::vec3 v2 = getVertex(m_vertex_indices[3 * trid + 2]);
 	
 	return v0 * uvw.x + uvw.y * v1 + uvw.z * v2;
 
 }
 
-glm::vec3 Mesh::sampleTriangleNormal(uint32_t trid, glm::vec3 uvw)
+glm::vec3 Mesh::sampleTriangleNormal(size_t trid, glm::vec3 uvw)
 {
-	glm::vec3 n0 = m_normal_buffer[m_triangles[trid].m_normal[0]];
-	glm::vec3 n1 = m_normal_buffer[m_triangles[trid].m_normal[1]];
-	glm::vec3 n2 = m_normal_buffer[m_triangles[trid].m_normal[2]];
+	if (!hasVertexNormals())
+		return m_face_normals[trid];
+	glm::vec3 n0 = getNormal(getNormalIndex(trid, 0));
+	glm::vec3 n1 = getNormal(getNormalIndex(trid, 1));
+	glm::vec3 n2 = getNormal(getNormalIndex(trid, 2));
 	return glm::normalize(n0 * uvw.x + uvw.y * n1 + uvw.z * n2);
 	 
 }
 
-glm::vec3 Mesh::sampleTriangleColor(uint32_t trid, glm::vec3 uvw)
+void Mesh::sampleTrianglePositions(size_t trid, const glm::vec3* uvw, int count, glm::vec3* positions)
+{
+	glm::vec3 v0 = getVertex(m_vertex_indices[3 * trid + 0]);
+	glm::vec3 v1 = getVertex(m_vertex_indices[3 * trid + 1]);
+	glm::vec3 v2 = getVertex(m_vertex_indices[3 * trid + 2]);
+	for (int i = 0; i < count; i++)
+		positions[i] = v0 * uvw[i].x + uvw[i].y * v1 + uvw[i].z * v2;
+}
+
+void Mesh::sampleTriangleNormals(size_t trid, const glm::vec3* uvw, int count, glm::vec3* normals)
+{
+	if (!hasVertexNormals())
+	{
+		std::fill(normals, normals + count, m_face_normals[trid]);
+		return;
+	}
+	glm::vec3 n0 = getNormal(getNormalIndex(trid, 0));
+	glm::vec3 n1 = getNormal(getNormalIndex(trid, 1));
+	glm::vec3 n2 = getNormal(getNormalIndex(trid, 2));
+	for (int i = 0; i < count; i++)
+		normals[i] = glm::normalize(n0 * uvw[i].x + uvw[i].y * n1 + uvw[i].z * n2);
+}
+
+glm::vec3 Mesh::sampleTriangleColor(size_t trid, glm::vec3 uvw, float footprint)
 {
-	TriangleGroup& group = m_groups[m_triangles[trid].m_gid];
+	TriangleGroup& group = m_groups[m_triangle_groups[trid]];
 	Material & mat = m_materials[group.matname];
-	if (mat.m_tid_color == -1)
+	// textures that failed to load fall back to the base color
+	if (mat.m_tid_color == -1 || !TextureManager::getInstance().getTexture(mat.m_tid_color))
 	{
 		return mat.m_base_color;
 	}
 	
-	glm::vec3 tc0 = m_coords_buffer[m_triangles[trid].m_coords[0]];
-	glm::vec3 tc1 = m_coords_buffer[m_triangles[trid].m_coords[1]];
-	glm::vec3 tc2 = m_coords_buffer[m_triangles[trid].m_coords[2]];
+	glm::vec3 tc0 = m_coords_buffer[getCoordsIndex(trid, 0)];
+	glm::vec3 tc1 = m_coords_buffer[getCoordsIndex(trid, 1)];
+	glm::vec3 tc2 = m_coords_buffer[getCoordsIndex(trid, 2)];
 
 	glm::vec3 texcoord = tc0 * uvw.x + tc1 * uvw.y + tc2 * uvw.z;
-	glm::vec4 color = TextureManager::getInstance().sampleTexture(mat.m_tid_color, texcoord.x, texcoord.y);
+	glm::vec4 color = TextureManager::getInstance().sampleTexture(mat.m_tid_color, texcoord.x, texcoord.y, footprint);
 
 	return glm::vec3(color);
 }
 
-bool Mesh::closestPointToTriangle(glm::vec3 & cp, const Triangle & tr, const glm::vec3 & pos, float & min_distance, glm::vec3 & normal, bool compute_normal) const
+void Mesh::sampleTriangleColors(size_t trid, const glm::vec3* uvw, int count, glm::vec3* colors, float footprint)
+{
+	TriangleGroup& group = m_groups[m_triangle_groups[trid]];
+	Material & mat = m_materials[group.matname];
+	if (mat.m_tid_color == -1 || !TextureManager::getInstance().getTexture(mat.m_tid_color))
+	{
+		std::fill(colors, colors + count, mat.m_base_color);
+		return;
+	}
+
+	glm::vec3 tc0 = m_coords_buffer[getCoordsIndex(trid, 0)];
+	glm::vec3 tc1 = m_coords_buffer[getCoordsIndex(trid, 1)];
+	glm::vec3 tc2 = m_coords_buffer[getCoordsIndex(trid, 2)];
+
+	const int block = 64;
+	float u[block], v[block];
+	glm::vec4 texels[block];
+	for (int first = 0; first < count; first += block)
+	{
+		int n = std::min(block, count - first);
+		for (int i = 0; i < n; i++)
+		{
+			glm::vec3 texcoord = tc0 * uvw[first + i].x + tc1 * uvw[first + i].y + tc2 * uvw[first + i].z;
+			u[i] = texcoord.x;
+			v[i] = texcoord.y;
+		}
+		TextureManager::getInstance().sampleTexture(mat.m_tid_color, u, v, texels, n, footprint);
+		for (int i = 0; i < n; i++)
+			colors[first + i] = glm::vec3(texels[i]);
+	}
+}
+
+float Mesh::getTriangleTextureArea(size_t trid)
+{
+	glm::vec3 tc0 = m_coords_buffer[getCoordsIndex(trid, 0)];
+	glm::vec3 tc1 = m_coords_buffer[getCoordsIndex(trid, 1)];
+	glm::vec3 tc2 = m_coords_buffer[getCoordsIndex(trid, 2)];
+	glm::vec2 e1 = glm::vec2(tc1 - tc0), e2 = glm::vec2(tc2 - tc0);
+	return 0.5f * fabs(e1.x * e2.y - e1.y * e2.x);
+}
+
+bool Mesh::closestPointToTriangle(glm::vec3 & cp, uint32_t trid, const glm::vec3 & pos, float & min_distance, glm::vec3 & normal, bool compute_normal) const
 {
 	glm::vec3 vertex[3];
 	glm::vec3 normals[3];
-	vertex[0] = m_vertex_buffer[tr.m_vertex[0]];
-	vertex[1] = m_vertex_buffer[tr.m_vertex[1]];
-	vertex[2] = m_vertex_buffer[tr.m_vertex[2]];
-	normals[0] = m_normal_buffer[tr.m_normal[0]];
-	normals[1] = m_normal_buffer[tr.m_normal[1]];
-	normals[2] = m_normal_buffer[tr.m_normal[2]];
+	const glm::vec3& face_normal = m_face_normals[trid];
+	vertex[0] = m_vertex_buffer[m_vertex_indices[3 * trid + 0]];
+	vertex[1] = m_vertex_buffer[m_vertex_indices[3 * trid + 1]];
+	vertex[2] = m_vertex_buffer[m_vertex_indices[3 * trid + 2]];
+	if (compute_normal)
+	{
+		if (m_normal_buffer.empty())
+			normals[0] = normals[1] = normals[2] = face_normal;
+		else
+		{
+			normals[0] = m_normal_buffer[getNormalIndex(trid, 0)];
+			normals[1] = m_normal_buffer[getNormalIndex(trid, 1)];
+			normals[2] = m_normal_buffer[getNormalIndex(trid, 2)];
+		}
+	}
 
 
-	float dist = glm::dot(pos, tr.m_face_normal) - glm::dot(vertex[0], tr.m_face_normal);
+	float dist = glm::dot(pos, face_normal) - glm::dot(vertex[0], face_normal);
 
 	if (fabs(dist) > fabs(min_distance)) // no distance to triangle surf, edge or vertex can be closer, so exit
 		return false;
 
 	// Project p onto the plane by stepping the distance from p to the plane
 	// in the direction opposite the normal: proj = p - dist * n
-	glm::vec3 proj = pos - dist * tr.m_face_normal;
+	glm::vec3 proj = pos - dist * face_normal;
 
 	// Find out if the projected point falls within the triangle -- see:
 	// http://blackpawn.com/texts/pointinpoly/default.html
@@ -593,29 +1512,103 @@ bool Mesh::closestPointToTriangle(glm::vec3 & cp, const Triangle & tr, const glm
 	return true;
 }
 
-void Mesh::sampleAreaWeighted(glm::vec3 & pos, glm::vec3 & normal, uint32_t & trid, float * pdf)
+void Mesh::sampleAreaWeighted(glm::vec3 & pos, glm::vec3 & normal, size_t & trid, float * pdf)
 {
-	float xsi = sampleUniform0to1();
-	auto iter = std::upper_bound(m_area_cdf.begin(), m_area_cdf.end(), xsi);
-	trid = std::min<size_t>(std::distance(m_area_cdf.begin(), iter),m_area_cdf.size()-1);
+	trid = sampleTriangleByArea(sampleUniform0to1d());
 	if (pdf) *pdf = 1.0f / m_area;
 
-	xsi = sampleUniform0to1();
+	float xsi = sampleUniform0to1();
 	float psi = sampleUniform0to1();
 	if (xsi + psi > 1.0f)
 	{
 		xsi = 1.0f - xsi;
 		psi = 1.0f - psi;
 	}
-	glm::vec3 v0 = m_vertex_buffer[m_triangles[trid].m_vertex[0]];
-	glm::vec3 v1 = m_vertex_buffer[m_triangles[trid].m_vertex[1]];
-	glm::vec3 v2 = m_vertex_buffer[m_triangles[trid].m_vertex[2]];
-	glm::vec3 n0 = m_normal_buffer[m_triangles[trid].m_normal[0]];
-	glm::vec3 n1 = m_normal_buffer[m_triangles[trid].m_normal[1]];
-	glm::vec3 n2 = m_normal_buffer[m_triangles[trid].m_normal[2]];
+	glm::vec3 v0 = getVertex(m_vertex_indices[3 * trid + 0]);
+	glm::vec3 v1 = getVertex(m_vertex_indices[3 * trid + 1]);
+	glm::vec3 v2 = getVertex(m_vertex_indices[3 * trid + 2]);
+	pos = v0 * (1.0f - xsi - psi) + xsi * v1 + psi * v2;
+	normal = sampleTriangleNormal(trid, glm::vec3(1.0f - xsi - psi, xsi, psi));
+}
 
+float Mesh::getPointToMeshDistance(const glm::vec3& q, glm::vec3& p_closest, glm::vec3& n_closest, uint32_t* trid) const
+{
+	float distance = FLT_MAX;
+	m_bvh.closest(q, distance, [&](uint32_t id, float& max_distance)
+		{
+			if (!closestPointToTriangle(p_closest, id, q, max_distance, n_closest, true))
+				return false;
+			if (trid) *trid = id;
+			return true;
+		});
+	return distance;
+}
 
-	pos = v0 * (1.0f - xsi - psi) + xsi * v1 + psi * v2;
-	normal = glm::normalize(n0 * (1.0f - xsi - psi) + xsi * n1 + psi * n2);
+float Mesh::getPointToMeshSignedDistance(const glm::vec3& q, glm::vec3& p_closest, glm::vec3& n_closest, const WindingNumber& winding) const
+{
+	float distance = getPointToMeshDistance(q, p_closest, n_closest);
+	if (distance == FLT_MAX)
+		return distance;
+	// the face of the closest triangle is not a reliable side test when the closest point is on an
+	// edge or a vertex, where the winning triangle is arbitrary
+	return winding.inside(q) ? -distance : distance;
+}
+
+bool Mesh::intersectTriangle(uint32_t trid, const glm::vec3& origin, const glm::vec3& dir, float& t) const
+{
+	// [Moller and Trumbore 1997]
+	glm::vec3 v0 = m_vertex_buffer[m_vertex_indices[3 * trid + 0]];
+	glm::vec3 e1 = m_vertex_buffer[m_vertex_indices[3 * trid + 1]] - v0;
+	glm::vec3 e2 = m_vertex_buffer[m_vertex_indices[3 * trid + 2]] - v0;
+	glm::vec3 p = glm::cross(dir, e2);
+	float det = glm::dot(e1, p);
+	if (fabs(det) < 1.0e-12f)
+		return false;
+	float inv_det = 1.0f / det;
+	glm::vec3 s = origin - v0;
+	float u = glm::dot(s, p) * inv_det;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(dir, q) * inv_det;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	float dist = glm::dot(e2, q) * inv_det;
+	if (dist <= 0.0f || dist >= t)
+		return false;
+	t = dist;
+	return true;
 }
 
+float Mesh::intersect(const glm::vec3& origin, const glm::vec3& dir, float tmax, uint32_t* trid, uint32_t ignore) const
+{
+	float t = tmax;
+	bool hit = m_bvh.intersect(origin, dir, t, [&](uint32_t id, float& tmax)
+		{
+			if (id == ignore || !intersectTriangle(id, origin, dir, tmax))
+				return false;
+			if (trid) *trid = id;
+			return true;
+		});
+	return hit ? t : FLT_MAX;
+}
+
+bool Mesh::occluded(const glm::vec3& origin, const glm::vec3& dir, float tmax, uint32_t ignore) const
+{
+	float t = tmax;
+	return m_bvh.intersect(origin, dir, t, [&](uint32_t id, float& tmax)
+		{
+			return id != ignore && intersectTriangle(id, origin, dir, tmax);
+		}, true);
+}
+
+uint32_t Mesh::occluded(const RayPacket& packet, uint32_t active) const
+{
+	return m_bvh.occluded(packet, active, [&](uint32_t id, int lane)
+		{
+			if (id == packet.m_ignore[lane])
+				return false;
+			float t = packet.m_tmax[lane];
+			return intersectTriangle(id, packet.origin(lane), packet.direction(lane), t);
+		});
+}
\ No newline at end of file
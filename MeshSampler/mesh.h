@@ -4,21 +4,162 @@
 #include <string>
 #include <glm/glm.hpp>
 #include <fstream>
+#include "bvh.h"
+#include "defs.h"
+#include "MeshArray.h"
+#include "MappedFile.h"
+#include "Quantization.h"
 
-struct Triangle
+class WindingNumber;
+
+// triangles per block of the parallel prefix sum of the area CDF
+#define AREA_CDF_BLOCK_SIZE (1LL << 16)
+
+// Triangle indices, stored in 32 bits unless an index does not fit, then widened to 64 bits
+// once for all, so that ordinary meshes keep compact index arrays.
+class IndexBuffer
+{
+	MeshArray<uint32_t> m_indices32;
+	MeshArray<uint64_t> m_indices64;
+	bool m_wide = false;
+
+	void widen()
+	{
+		m_indices64.assign(m_indices32.begin(), m_indices32.end());
+		m_indices32.clear();
+		m_wide = true;
+	}
+
+public:
+	bool isWide() const { return m_wide; }
+	size_t size() const { return m_wide ? m_indices64.size() : m_indices32.size(); }
+	bool empty() const { return size() == 0; }
+	size_t operator[](size_t i) const { return m_wide ? (size_t)m_indices64[i] : m_indices32[i]; }
+
+	void push_back(uint64_t index)
+	{
+		if (!m_wide && index > UINT32_MAX)
+			widen();
+		if (m_wide)
+			m_indices64.push_back(index);
+		else
+			m_indices32.push_back((uint32_t)index);
+	}
+	// allocates count indices of an empty buffer, wide enough for indices up to max_index
+	void reserve(size_t count, uint64_t max_index)
+	{
+		clear();
+		m_wide = max_index > UINT32_MAX;
+		if (m_wide)
+			m_indices64.reserve(count);
+		else
+			m_indices32.reserve(count);
+	}
+	// count indices, wide enough for indices up to max_index; set() fills them
+	void resize(size_t count, uint64_t max_index)
+	{
+		clear();
+		m_wide = max_index > UINT32_MAX;
+		if (m_wide)
+			m_indices64.resize(count);
+		else
+			m_indices32.resize(count);
+	}
+	void set(size_t i, uint64_t index)
+	{
+		if (m_wide)
+			m_indices64[i] = index;
+		else
+			m_indices32[i] = (uint32_t)index;
+	}
+	// views count indices of a memory mapped file
+	void map(const void* data, size_t count, bool wide)
+	{
+		clear();
+		m_wide = wide;
+		if (m_wide)
+			m_indices64.map(data, count);
+		else
+			m_indices32.map(data, count);
+	}
+	bool isMapped() const { return m_indices32.isMapped() || m_indices64.isMapped(); }
+	const void* data() const { return m_wide ? (const void*)m_indices64.data() : (const void*)m_indices32.data(); }
+	size_t bytes() const { return size() * (m_wide ? sizeof(uint64_t) : sizeof(uint32_t)); }
+	// releases the memory
+	void clear()
+	{
+		m_indices32.clear();
+		m_indices64.clear();
+		m_wide = false;
+	}
+	void shrink_to_fit() { m_indices32.shrink_to_fit(); m_indices64.shrink_to_fit(); }
+	void swap(IndexBuffer& other)
+	{
+		m_indices32.swap(other.m_indices32);
+		m_indices64.swap(other.m_indices64);
+		std::swap(m_wide, other.m_wide);
+	}
+	bool operator==(const IndexBuffer& other) const
+	{
+		if (m_wide == other.m_wide)
+			return m_indices32 == other.m_indices32 && m_indices64 == other.m_indices64;
+		if (size() != other.size())
+			return false;
+		for (size_t i = 0; i < size(); i++)
+			if ((*this)[i] != other[i])
+				return false;
+		return true;
+	}
+
+	// calls f with a pointer to the indices, of the stored width, so that loops over all the
+	// indices are instantiated for each width instead of testing it per index
+	template <typename F>
+	void visit(F f) const
+	{
+		if (m_wide)
+			f(m_indices64.data());
+		else
+			f(m_indices32.data());
+	}
+};
+
+#define MESH_STORE_VERSION 5
+// arrays of a mesh store start on page boundaries, so that their pages can be advised separately
+#define MESH_STORE_ALIGNMENT 4096
+// triangles ahead of the in-order sampling traversal whose pages are requested from the store
+#define MESH_STORE_PREFETCH (1 << 16)
+
+// arrays of a mesh store, in file order
+enum mesh_store_array_t { STORE_VERTICES, STORE_NORMALS, STORE_COORDS, STORE_VERTEX_INDICES, STORE_NORMAL_INDICES,
+	STORE_COORDS_INDICES, STORE_AREAS, STORE_GROUPS, STORE_FACE_NORMALS, STORE_ARRAYS };
+
+// Header of the binary mesh stores (".msm"), whose vertex and triangle arrays are memory mapped
+// instead of being held in memory. The groups and the material library name follow the arrays.
+// The source fields identify stores of modified OBJ files.
+struct MeshStoreHeader
 {
-	unsigned int m_vertex[3];
-	unsigned int m_normal[3];
-	unsigned int m_coords[3];
-	float m_area;
-	int m_gid = 0;
-	glm::vec3 m_face_normal;
+	char m_magic[4] = { 'M', 'S', 'M', 'S' };
+	uint32_t m_version = MESH_STORE_VERSION;
+	int32_t m_attribs = 0;   // MASK_* attributes loaded from the OBJ file
+	uint32_t m_wide = 0;     // bit per index array, set for 64-bit indices
+	uint32_t m_reordered = 0; // triangles and vertices in spatial order, see Mesh::reorder()
+	uint32_t m_welded = 0;    // duplicates removed, see Mesh::weld()
+	uint64_t m_source_size = 0;
+	uint64_t m_source_time = 0;
+	float m_area = 0.0f;
+	float m_min[3] = { 0.0f, 0.0f, 0.0f };
+	float m_max[3] = { 0.0f, 0.0f, 0.0f };
+	float m_crease_angle = -1.0f; // of the smooth normals of faces without normals, negative if none
+	uint64_t m_count[STORE_ARRAYS] = {};  // elements of each array
+	uint64_t m_offset[STORE_ARRAYS] = {};
+	uint64_t m_groups_offset = 0;
+	uint64_t m_groups_size = 0;
 };
 
 struct TriangleGroup
 {
-	unsigned int m_start = 0;
-	unsigned int m_length = 0;
+	size_t m_start = 0;
+	size_t m_length = 0;
 	float m_classification = 0.5f;
 	std::string matname;
 };
@@ -48,13 +189,29 @@ public:
 	float				m_area;
 	std::string			m_filename;
 
-	std::vector<glm::vec3> m_vertex_buffer;
-	std::vector<glm::vec3> m_normal_buffer;
+	MappedFile m_store; // mesh store the arrays are mapped from, if any
+
+	MeshArray<glm::vec3> m_vertex_buffer;
+	MeshArray<glm::vec3> m_normal_buffer; // empty if normals were not loaded, face normals are used instead
 	std::vector<glm::vec3> m_color_buffer;
-	std::vector<glm::vec3> m_coords_buffer; // 3rd coord is the gid
-	std::vector<Triangle> m_triangles;
+	MeshArray<glm::vec3> m_coords_buffer; // 3rd coord is the gid
+	// compact copies replacing the vertex and normal buffers once quantized, see quantize()
+	QuantizedPositions m_quantized_vertices;
+	OctahedralNormals m_quantized_normals;
+
+	// triangles, as a structure of arrays so that each pass only streams the attributes it reads.
+	// The index arrays hold 3 indices per triangle; the normal and texture coordinate index arrays
+	// are empty when identical to the vertex indices or when the attribute was not loaded.
+	IndexBuffer m_vertex_indices;
+	IndexBuffer m_normal_indices;
+	IndexBuffer m_coords_indices;
+	MeshArray<float> m_triangle_areas;
+	MeshArray<int> m_triangle_groups;
+	MeshArray<glm::vec3> m_face_normals;
 	std::vector<TriangleGroup> m_groups;
-	std::vector<float> m_area_cdf; 
+	std::vector<double> m_area_cdf; // double, so that single triangles of huge meshes keep a nonzero probability
+
+	BVH m_bvh; // over the triangles, built on demand for proximity queries
 
 	std::map<std::string, Material> m_materials;
 	std::string m_mtl_filename;
@@ -63,18 +220,71 @@ public:
 	glm::vec3 m_max = { -FLT_MAX,-FLT_MAX, -FLT_MAX };
 	
 	virtual ~Mesh();
-	bool readMTL(std::string filename);
-	bool readobj(std::string filename);
+	size_t getNumTriangles() const { return m_vertex_indices.size() / 3; }
+	size_t getNormalIndex(size_t trid, int k) const { return m_normal_indices.empty() ? m_vertex_indices[3 * trid + k] : m_normal_indices[3 * trid + k]; }
+	size_t getCoordsIndex(size_t trid, int k) const { return m_coords_indices.empty() ? m_vertex_indices[3 * trid + k] : m_coords_indices[3 * trid + k]; }
+	// textures are only decoded with load_textures
+	bool readMTL(std::string filename, bool load_textures = true);
+	// attribs: MASK_* attributes needed, normals are only stored with MASK_NORMALS,
+	// texture coordinates and textures with MASK_COLORS
+	// crease_angle: if not negative, faces without normals get smooth vertex normals, not averaged
+	// across edges sharper than crease_angle degrees, instead of their face normal
+	bool readobj(std::string filename, int attribs = MASK_VERTICES | MASK_NORMALS | MASK_COLORS, float crease_angle = -1.0f);
+	// reads the OBJ file through its mesh store "filename.msm", built on first use, with the
+	// vertex and triangle arrays memory mapped from the store
+	bool readMapped(std::string filename, int attribs = MASK_VERTICES | MASK_NORMALS | MASK_COLORS, bool reorder = false,
+		bool weld = false, float crease_angle = -1.0f);
+	bool writeStore(const std::string& filename, MeshStoreHeader header) const;
+	// maps the arrays of a valid store with the attributes needed
+	bool mapStore(const std::string& filename, const MeshStoreHeader& source);
+	// hints the access pattern (MAPPED_ADVICE_*) of the mapped arrays; none for meshes in memory
+	void adviseAccess(int advice);
+	// requests the pages of count triangles from first of the mapped arrays
+	void prefetchTriangles(size_t first, size_t count);
 	void flatten();
+	// computes the normals of the corners of the triangles flagged in missing, see readobj
+	void computeSmoothNormals(const std::vector<unsigned char>& missing, float crease_angle);
+	// sorts the triangles of each group along a Morton curve of their centroids and renumbers the
+	// vertices in order of first use, restoring the spatial coherence of shuffled meshes
+	void reorder();
+	// welds the vertices whose position and shared attributes are identical, removes the triangles
+	// repeating the positions of another one (in any order) or without area, and the unused vertices
+	void weld();
+	// replaces the vertex and normal buffers by positions quantized to 16 or 21 bits per axis and
+	// octahedral normals, for meshes whose float vertices do not fit in memory. Only sampling decodes
+	// them: proximity queries and the passes above need the float buffers.
+	void quantize(int bits);
+	bool isQuantized() const { return !m_quantized_vertices.empty(); }
+	glm::vec3 getVertex(size_t index) const { return m_quantized_vertices.empty() ? m_vertex_buffer[index] : m_quantized_vertices[index]; }
+	glm::vec3 getNormal(size_t index) const { return m_quantized_normals.empty() ? m_normal_buffer[index] : m_quantized_normals[index]; }
+	bool hasVertexNormals() const { return !m_normal_buffer.empty() || !m_quantized_normals.empty(); }
 	void computeMetrics();
+	void computeAreaCDF();
+	void buildBVH();
+
+	glm::vec3 sampleTrianglePosition(size_t trid, glm::vec3 uvw);
+	glm::vec3 sampleTriangleNormal(size_t trid, glm::vec3 uvw);
+	// batched versions, decoding the triangle vertices once
+	void sampleTrianglePositions(size_t trid, const glm::vec3* uvw, int count, glm::vec3* positions);
+	void sampleTriangleNormals(size_t trid, const glm::vec3* uvw, int count, glm::vec3* normals);
+	// footprint: texture space extent of the sample, for prefiltered texture lookups
+	glm::vec3 sampleTriangleColor(size_t trid, glm::vec3 uvw, float footprint = 0.0f);
+	void sampleTriangleColors(size_t trid, const glm::vec3* uvw, int count, glm::vec3* colors, float footprint = 0.0f);
+	float getTriangleTextureArea(size_t trid);
 
-	glm::vec3 sampleTrianglePosition(uint32_t trid, glm::vec3 uvw);
-	glm::vec3 sampleTriangleNormal(uint32_t trid, glm::vec3 uvw);
-	glm::vec3 sampleTriangleColor(uint32_t trid, glm::vec3 uvw);
 
+	size_t sampleTriangleByArea(double xsi) const;
+	void sampleAreaWeighted(glm::vec3 & pos, glm::vec3 & normal, size_t & trid, float * pdf = nullptr);
+	bool closestPointToTriangle(glm::vec3 & cp, uint32_t trid, const glm::vec3 & pos, float & max_distance, glm::vec3 & normal, bool compute_normal = false) const;
 
-	void sampleAreaWeighted(glm::vec3 & pos, glm::vec3 & normal, uint32_t & trid, float * pdf = nullptr);
-	bool closestPointToTriangle(glm::vec3 & cp, const Triangle & tr, const glm::vec3 & pos, float & max_distance, glm::vec3 & normal, bool compute_normal = false) const;
+	float getPointToMeshDistance(const glm::vec3& q, glm::vec3& p_closest, glm::vec3& n_closest, uint32_t* trid = nullptr) const;
+	// negative inside, as classified by the winding number of the mesh
+	float getPointToMeshSignedDistance(const glm::vec3& q, glm::vec3& p_closest, glm::vec3& n_closest, const WindingNumber& winding) const;
 
-	float getPointToMeshDistance(const glm::vec3& q, glm::vec3& p_closest, glm::vec3& n_closest) const;
+	bool intersectTriangle(uint32_t trid, const glm::vec3& origin, const glm::vec3& dir, float& t) const;
+	// closest hit along the ray within (0, tmax); returns FLT_MAX on a miss
+	float intersect(const glm::vec3& origin, const glm::vec3& dir, float tmax = FLT_MAX, uint32_t* trid = nullptr, uint32_t ignore = UINT32_MAX) const;
+	bool occluded(const glm::vec3& origin, const glm::vec3& dir, float tmax = FLT_MAX, uint32_t ignore = UINT32_MAX) const;
+	// returns the bit mask of the active rays of the packet that are occluded
+	uint32_t occluded(const RayPacket& packet, uint32_t active) const;
 };
\ No newline at end of file
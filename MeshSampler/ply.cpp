@@ -2,6 +2,8 @@
 #include "defs.h"
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 
 bool plyInit(std::string filename, unsigned char mask, size_t count)
 {
@@ -33,8 +35,15 @@ bool plyInit(std::string filename, unsigned char mask, size_t count)
 		fprintf(fp, "property uchar green\n");
 		fprintf(fp, "property uchar blue\n");
 	}
+	if (mask & MASK_DISTANCE)
+		fprintf(fp, "property float distance\n");
+	if (mask & MASK_OCCUPANCY)
+		fprintf(fp, "property uchar occupancy\n");
+	if (mask & MASK_OCCLUSION)
+		fprintf(fp, "property float occlusion\n");
 	fprintf(fp, "end_header\n");
 	fclose(fp);
+	return true;
 }
 
 bool plyUpdateHeader(std::string filename, size_t count)
@@ -68,7 +77,10 @@ bool plyUpdateHeader(std::string filename, size_t count)
 bool plyAppendPoints(std::string filename, unsigned char mask,
 	const std::vector<glm::vec3>* vertices,
 	const std::vector<glm::vec3>* colors,
-	const std::vector<glm::vec3>* normals)
+	const std::vector<glm::vec3>* normals,
+	const std::vector<float>* distances,
+	const std::vector<unsigned char>* occupancy,
+	const std::vector<float>* occlusion)
 {
 	FILE* fp = nullptr;
 	fopen_s(&fp, filename.c_str(), "ab");
@@ -94,6 +106,12 @@ bool plyAppendPoints(std::string filename, unsigned char mask,
 			c[2] = (unsigned char) ((*colors)[i].b * 255);
 			fwrite(c, 3, 1, fp);
 		}
+		if (mask & MASK_DISTANCE && distances)
+			fwrite(&((*distances)[i]), sizeof(float), 1, fp);
+		if (mask & MASK_OCCUPANCY && occupancy)
+			fwrite(&((*occupancy)[i]), 1, 1, fp);
+		if (mask & MASK_OCCLUSION && occlusion)
+			fwrite(&((*occlusion)[i]), sizeof(float), 1, fp);
 
 	}
 	fclose(fp);
@@ -101,3 +119,159 @@ bool plyAppendPoints(std::string filename, unsigned char mask,
 	return true;
 }
 
+static size_t plyTypeSize(const std::string& type)
+{
+	if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+		return 1;
+	if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+		return 2;
+	if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32")
+		return 4;
+	if (type == "double" || type == "float64")
+		return 8;
+	return 0;
+}
+
+bool plyOpen(std::string filename, PlyReader& reader)
+{
+	reader = PlyReader();
+	fopen_s(&reader.m_fp, filename.c_str(), "rb");
+	if (!reader.m_fp)
+	{
+		printf("Error opening file %s\n", filename.c_str());
+		return false;
+	}
+
+	char buf[256];
+	bool in_vertex = false, seen_vertex = false;
+	bool found[3] = { false, false, false };
+	const char* names[3] = { "x", "y", "z" };
+	size_t property = 0;
+	while (fgets(buf, sizeof(buf), reader.m_fp))
+	{
+		std::istringstream line(buf);
+		std::string key;
+		line >> key;
+		if (key == "format")
+		{
+			std::string format;
+			line >> format;
+			if (format == "ascii")
+				reader.m_binary = false;
+			else if (format != "binary_little_endian")
+			{
+				printf("Unsupported PLY format %s in %s\n", format.c_str(), filename.c_str());
+				break;
+			}
+		}
+		else if (key == "element")
+		{
+			std::string name;
+			line >> name;
+			in_vertex = (name == "vertex");
+			if (in_vertex)
+			{
+				line >> reader.m_count;
+				seen_vertex = true;
+			}
+			else if (!seen_vertex)
+			{
+				// vertices are read sequentially, so they must be the first element in the file
+				printf("Unsupported element order in %s\n", filename.c_str());
+				break;
+			}
+		}
+		else if (key == "property" && in_vertex)
+		{
+			std::string type, name;
+			line >> type >> name;
+			size_t size = plyTypeSize(type);
+			if (size == 0)
+			{
+				printf("Unsupported vertex property type %s in %s\n", type.c_str(), filename.c_str());
+				break;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				if (name != names[k])
+					continue;
+				if (type != "float" && type != "float32" && type != "double" && type != "float64")
+					break;
+				found[k] = true;
+				reader.m_double[k] = (size == 8);
+				reader.m_offset[k] = reader.m_binary ? reader.m_stride : property;
+			}
+			reader.m_stride += reader.m_binary ? size : 1;
+			property++;
+		}
+		else if (key == "end_header")
+		{
+			if (found[0] && found[1] && found[2])
+				return true;
+			printf("Missing float x, y, z vertex properties in %s\n", filename.c_str());
+			break;
+		}
+	}
+	plyClose(reader);
+	return false;
+}
+
+size_t plyReadPoints(PlyReader& reader, std::vector<glm::vec3>& points, size_t max_count)
+{
+	points.clear();
+	if (!reader.m_fp)
+		return 0;
+
+	size_t count = std::min(max_count, reader.m_count - reader.m_read);
+	points.resize(count);
+	if (reader.m_binary)
+	{
+		reader.m_buffer.resize(count * reader.m_stride);
+		count = fread(reader.m_buffer.data(), reader.m_stride, count, reader.m_fp);
+		for (size_t i = 0; i < count; i++)
+		{
+			const char* record = &reader.m_buffer[i * reader.m_stride];
+			for (int k = 0; k < 3; k++)
+			{
+				if (reader.m_double[k])
+				{
+					double d;
+					memcpy(&d, record + reader.m_offset[k], sizeof(double));
+					points[i][k] = (float)d;
+				}
+				else
+					memcpy(&points[i][k], record + reader.m_offset[k], sizeof(float));
+			}
+		}
+	}
+	else
+	{
+		double value;
+		for (size_t i = 0; i < count; i++)
+		{
+			for (size_t p = 0; p < reader.m_stride; p++)
+			{
+				if (fscanf_s(reader.m_fp, "%lf", &value) != 1)
+				{
+					// truncated file
+					reader.m_count = reader.m_read + i;
+					count = i;
+					break;
+				}
+				for (int k = 0; k < 3; k++)
+					if (reader.m_offset[k] == p)
+						points[i][k] = (float)value;
+			}
+		}
+	}
+	points.resize(count);
+	reader.m_read += count;
+	return count;
+}
+
+void plyClose(PlyReader& reader)
+{
+	if (reader.m_fp)
+		fclose(reader.m_fp);
+	reader.m_fp = nullptr;
+}
@@ -2,11 +2,32 @@
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
+#include <cstdio>
 
 bool plyInit(std::string filename, unsigned char mask, size_t count);
 bool plyUpdateHeader(std::string filename, size_t count);
 bool plyAppendPoints(std::string filename, unsigned char mask,
 	const std::vector<glm::vec3>* vertices,
 	const std::vector<glm::vec3>* colors,
-	const std::vector<glm::vec3>* normals);
+	const std::vector<glm::vec3>* normals,
+	const std::vector<float>* distances = nullptr,
+	const std::vector<unsigned char>* occupancy = nullptr,
+	const std::vector<float>* occlusion = nullptr);
+
+// Sequential reader for the vertex positions of a PLY point cloud (ascii or binary little endian).
+struct PlyReader
+{
+	FILE* m_fp = nullptr;
+	bool m_binary = true;
+	size_t m_count = 0;      // number of vertices declared in the header
+	size_t m_read = 0;       // number of vertices read so far
+	size_t m_stride = 0;     // bytes per vertex record (binary) or number of properties (ascii)
+	size_t m_offset[3] = {}; // byte offset (binary) or property index (ascii) of x, y, z
+	bool m_double[3] = {};   // x, y, z stored as double
+	std::vector<char> m_buffer;
+};
+
+bool plyOpen(std::string filename, PlyReader& reader);
+size_t plyReadPoints(PlyReader& reader, std::vector<glm::vec3>& points, size_t max_count);
+void plyClose(PlyReader& reader);
 	
@@ -4,6 +4,9 @@
 #include <bitset>
 #include <filesystem>
 #include "TextureManager.h"
+#include "winding.h"
+#include "util.h"
+#include <omp.h>
 
 std::uniform_real_distribution<> _real_dist(0.0f,1.0f);
 std::random_device _rd;
@@ -14,6 +17,21 @@ float sampleUniform0to1()
 	return (float)_real_dist(_gen);
 }
 
+float sampleUniform0to1(std::mt19937& gen)
+{
+	return std::uniform_real_distribution<float>(0.0f, 1.0f)(gen);
+}
+
+double sampleUniform0to1d()
+{
+	return _real_dist(_gen);
+}
+
+double sampleUniform0to1d(std::mt19937& gen)
+{
+	return std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+}
+
 glm::vec3 sampleUnitSphere()
 {
 	glm::vec3 v = glm::vec3(sampleUniform0to1(), sampleUniform0to1(), sampleUniform0to1());
@@ -29,90 +47,432 @@ void MeshSampler::computeChunkSamples()
 bool MeshSampler::writeChunk()
 {
 	bool res;
+	if (m_attribs & MASK_OCCLUSION)
+		computeOcclusion();
 	res = plyUpdateHeader(m_output, m_total_samples);
-	res *= plyAppendPoints(m_output, m_attribs, &m_vertices, &m_colors, &m_normals);
+	res *= plyAppendPoints(m_output, m_attribs, &m_vertices, &m_colors, &m_normals, &m_distances, &m_occupancy, &m_occlusion);
 	m_vertices.clear();
 	m_colors.clear();
 	m_normals.clear();
+	m_distances.clear();
+	m_occupancy.clear();
+	m_occlusion.clear();
+	m_triangles.clear();
 
 	printf("\b\b\b\b\b%4.1f%%", 100.0f*std::min(1.0f,m_total_samples/(float)m_requested_samples));
 
 	return res;
 }
 
+void MeshSampler::computeVisibility()
+{
+	if (m_mesh->m_bvh.empty())
+		m_mesh->buildBVH();
+
+	// views evenly distributed on the sphere (fibonacci lattice)
+	std::vector<glm::vec3> views(m_visibility_views);
+	for (int i = 0; i < m_visibility_views; i++)
+	{
+		float z = 1.0f - 2.0f * (i + 0.5f) / m_visibility_views;
+		float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+		float phi = i * 2.39996323f;
+		views[i] = glm::vec3(r * cosf(phi), r * sinf(phi), z);
+	}
+
+	glm::vec3 center = 0.5f * (m_mesh->m_min + m_mesh->m_max);
+	float diagonal = glm::length(m_mesh->m_max - m_mesh->m_min);
+	float radius = std::max(m_visibility_distance, 0.51f) * diagonal;
+	bool directional = m_visibility_distance <= 0.0f;
+	float eps = 1.0e-5f * diagonal;
+
+	// a triangle is seen from a view if any of its probe points is
+	const glm::vec3 probes[4] = { glm::vec3(1.0f / 3.0f), glm::vec3(0.8f, 0.1f, 0.1f),
+		glm::vec3(0.1f, 0.8f, 0.1f), glm::vec3(0.1f, 0.1f, 0.8f) };
+
+	long long n = (long long)m_mesh->getNumTriangles();
+	m_weights.resize(n);
+	double weighted_area = 0.0;
+	long long visible = 0;
+
+	printf("Computing visibility from %d %s...", m_visibility_views, directional ? "directions" : "viewpoints");
+
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:weighted_area, visible)
+	for (long long tr = 0; tr < n; tr++)
+	{
+		int seen = 0;
+		for (int v = 0; v < m_visibility_views; v++)
+		{
+			for (int p = 0; p < 4; p++)
+			{
+				glm::vec3 pos = m_mesh->sampleTrianglePosition((uint32_t)tr, probes[p]);
+				glm::vec3 dir = views[v];
+				float tmax = FLT_MAX;
+				if (!directional)
+				{
+					dir = center + radius * views[v] - pos;
+					tmax = glm::length(dir);
+					dir /= tmax;
+				}
+				if (!m_mesh->occluded(pos + eps * dir, dir, tmax, (uint32_t)tr))
+				{
+					seen++;
+					break;
+				}
+			}
+		}
+		float weight = seen / (float)m_visibility_views;
+		if (!m_visibility_weighting && seen > 0)
+			weight = 1.0f;
+		m_weights[tr] = weight;
+		weighted_area += m_mesh->m_triangle_areas[tr] * (double)weight;
+		if (seen > 0)
+			visible++;
+	}
+	m_weighted_area = weighted_area;
+
+	printf("done. %lld of %lld triangles visible (%.1f%% of the weighted area).\n", visible, n,
+		100.0 * weighted_area / std::max(1.0e-30, (double)m_mesh->m_area));
+}
+
+void MeshSampler::computeOcclusion()
+{
+	if (m_mesh->m_bvh.empty())
+		m_mesh->buildBVH();
+
+	float diagonal = glm::length(m_mesh->m_max - m_mesh->m_min);
+	float tmax = m_ao_distance > 0.0f ? m_ao_distance * diagonal : FLT_MAX;
+	float eps = 1.0e-5f * diagonal;
+	unsigned int seed = std::random_device()();
+
+	// packets of consecutive (spatially coherent) samples; ray k of every sample in the packet
+	// uses the same direction in its local frame, so the packet stays coherent
+	long long n = (long long)m_vertices.size();
+	long long num_packets = (n + BVH_PACKET_SIZE - 1) / BVH_PACKET_SIZE;
+	m_occlusion.resize(n);
+
+#pragma omp parallel
+	{
+		std::seed_seq seq{ seed, (unsigned int) m_total_samples, (unsigned int) omp_get_thread_num() };
+		std::mt19937 gen(seq);
+		RayPacket packet;
+		glm::vec3 tangent[BVH_PACKET_SIZE], bitangent[BVH_PACKET_SIZE];
+
+#pragma omp for schedule(dynamic, 64)
+		for (long long p = 0; p < num_packets; p++)
+		{
+			long long first = p * BVH_PACKET_SIZE;
+			int count = (int) std::min<long long>(BVH_PACKET_SIZE, n - first);
+			uint32_t lanes = (1u << count) - 1;
+			int hits[BVH_PACKET_SIZE] = {};
+
+			for (int i = 0; i < count; i++)
+			{
+				// orthonormal frame [Duff et al. 2017]
+				const glm::vec3& nrm = m_normals[first + i];
+				float sign = copysignf(1.0f, nrm.z);
+				float a = -1.0f / (sign + nrm.z);
+				float b = nrm.x * nrm.y * a;
+				tangent[i] = glm::vec3(1.0f + sign * nrm.x * nrm.x * a, sign * b, -sign * nrm.x);
+				bitangent[i] = glm::vec3(b, sign + nrm.y * nrm.y * a, -nrm.y);
+			}
+
+			for (int k = 0; k < m_ao_rays; k++)
+			{
+				// cosine-weighted hemisphere direction
+				float u1 = sampleUniform0to1(gen), u2 = sampleUniform0to1(gen);
+				float r = sqrtf(u1), phi = 2.0f * PI * u2;
+				glm::vec3 local = glm::vec3(r * cosf(phi), r * sinf(phi), sqrtf(std::max(0.0f, 1.0f - u1)));
+				for (int i = 0; i < count; i++)
+				{
+					const glm::vec3& nrm = m_normals[first + i];
+					glm::vec3 dir = local.x * tangent[i] + local.y * bitangent[i] + local.z * nrm;
+					// rays start off the geometric plane, on the side of the shading normal, and skip the
+					// source triangle. Directions of the shading hemisphere below that plane would enter
+					// the surface, they are mirrored above it.
+					uint32_t tr = m_triangles[first + i];
+					glm::vec3 face_normal = m_mesh->m_face_normals[tr];
+					if (glm::dot(face_normal, nrm) < 0.0f)
+						face_normal = -face_normal;
+					float below = glm::dot(dir, face_normal);
+					if (below < 0.0f)
+						dir -= 2.0f * below * face_normal;
+					packet.set(i, m_vertices[first + i] + eps * face_normal, dir, tmax, tr);
+				}
+				uint32_t occluded = m_mesh->occluded(packet, lanes);
+				for (int i = 0; i < count; i++)
+					hits[i] += (occluded >> i) & 1;
+			}
+
+			for (int i = 0; i < count; i++)
+				m_occlusion[first + i] = hits[i] / (float) std::max(1, m_ao_rays);
+		}
+	}
+}
+
+void MeshSampler::computeTextureOrder()
+{
+	m_order.clear();
+	if (m_mesh->m_coords_buffer.empty())
+		return;
+
+	// color texture of each group, sorted after the untextured ones
+	std::vector<uint32_t> group_texture(m_mesh->m_groups.size());
+	for (size_t g = 0; g < m_mesh->m_groups.size(); g++)
+		group_texture[g] = (uint32_t)(m_mesh->m_materials[m_mesh->m_groups[g].matname].m_tid_color + 1);
+
+	long long num_triangles = (long long)m_mesh->getNumTriangles();
+	if (num_triangles > (long long)UINT32_MAX)
+	{
+		printf("Texture ordering is limited to 2^32 triangles, sampling in mesh order\n");
+		return;
+	}
+	std::vector<uint64_t> keys(num_triangles);
+	m_order.resize(num_triangles);
+#pragma omp parallel for
+	for (long long i = 0; i < num_triangles; i++)
+	{
+		uint64_t key = (uint64_t)group_texture[m_mesh->m_triangle_groups[i]] << 32;
+		if (key)
+		{
+			glm::vec3 center = (m_mesh->m_coords_buffer[m_mesh->getCoordsIndex(i, 0)] + m_mesh->m_coords_buffer[m_mesh->getCoordsIndex(i, 1)] +
+				m_mesh->m_coords_buffer[m_mesh->getCoordsIndex(i, 2)]) / 3.0f;
+			// wrapped into the unit square, as the texture lookups do
+			key |= mortonCode2D(center.x - floorf(center.x), center.y - floorf(center.y));
+		}
+		keys[i] = key;
+		m_order[i] = (uint32_t)i;
+	}
+	std::stable_sort(m_order.begin(), m_order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+}
+
 bool MeshSampler::sampleUniform()
 {
 	m_vertices.clear();
 	m_colors.clear();
 	m_normals.clear();
+	m_triangles.clear();
 	m_total_samples = 0;
 
 	if (m_attribs & MASK_VERTICES) m_vertices.reserve(m_chunk_samples);
 	if (m_attribs & MASK_COLORS)   m_colors.reserve(m_chunk_samples);
-	if (m_attribs & MASK_NORMALS)  m_normals.reserve(m_chunk_samples);
+	if (m_attribs & (MASK_NORMALS | MASK_OCCLUSION)) m_normals.reserve(m_chunk_samples);
+	if (m_attribs & MASK_OCCLUSION) m_triangles.reserve(m_chunk_samples);
+
+	glm::vec3 uvw[SAMPLE_BATCH_SIZE];
+	glm::vec3 values[SAMPLE_BATCH_SIZE];
+	size_t chunk_fill = 0;
 
 	printf("Progress: %4.1f%%", 0.0f);
 
 	// try to sample triangles in the same order as they appear in the mesh
-	// so that samples are more spatially coherent by construction
-	for (size_t tr = 0; tr < m_mesh->m_triangles.size(); tr++)
+	// so that samples are more spatially coherent by construction, unless
+	// scheduled for texture locality
+	double total_area = m_weights.empty() ? (double)m_mesh->m_area : m_weighted_area;
+	// the in-order traversal streams through a mapped mesh, requesting the next triangles ahead
+	m_mesh->adviseAccess(m_order.empty() ? MAPPED_ADVICE_SEQUENTIAL : MAPPED_ADVICE_RANDOM);
+	for (size_t k = 0; k < m_mesh->getNumTriangles(); k++)
 	{
-		double prob = m_mesh->m_triangles[tr].m_area / (double)m_mesh->m_area;
+		if (m_order.empty() && k % MESH_STORE_PREFETCH == 0)
+			m_mesh->prefetchTriangles(k, 2 * MESH_STORE_PREFETCH);
+		size_t tr = m_order.empty() ? k : m_order[k];
+		double prob = m_mesh->m_triangle_areas[tr] / total_area;
+		if (!m_weights.empty())
+			prob *= m_weights[tr];
 		
 		// sample each triangle at least once, except for zero-area ones.
-		int num_samples = (int) floor(m_requested_samples * prob);
+		size_t num_samples = (size_t) floor(m_requested_samples * prob);
 		if (num_samples == 0)
 		{
 			if (sampleUniform0to1() < m_requested_samples * prob)
 				num_samples = 1;
 		}
-		for (int i = 0; i < num_samples; i++)
+		// texture space extent of each sample, for the prefiltered color lookups
+		float footprint = 0.0f;
+		if (num_samples > 0 && (m_attribs & MASK_COLORS))
+			footprint = sqrtf(m_mesh->getTriangleTextureArea(tr) / num_samples);
+
+		// draw the samples of the triangle in batches, so that attribute lookups
+		// (texture filtering in particular) run over whole arrays
+		size_t remaining = num_samples;
+		while (remaining > 0)
 		{
-			float xsi = sampleUniform0to1();
-			float psi = sampleUniform0to1();
-			if (xsi + psi > 1.0f)
+			int batch = (int) std::min<size_t>(std::min<size_t>(remaining, SAMPLE_BATCH_SIZE), m_chunk_samples - chunk_fill);
+			for (int i = 0; i < batch; i++)
 			{
-				xsi = 1.0f - xsi;
-				psi = 1.0f - psi;
+				float xsi = sampleUniform0to1();
+				float psi = sampleUniform0to1();
+				if (xsi + psi > 1.0f)
+				{
+					xsi = 1.0f - xsi;
+					psi = 1.0f - psi;
+				}
+				uvw[i] = glm::vec3(1.0f - xsi - psi, xsi, psi);
 			}
-			
-			glm::vec3 uvw = glm::vec3(1.0f-xsi-psi,xsi,psi);
-			glm::vec3 pos, normal, color;
 
 			if (m_attribs & MASK_VERTICES)
 			{
-				pos = m_mesh->sampleTrianglePosition(tr, uvw);
-				m_vertices.push_back(pos);
+				m_mesh->sampleTrianglePositions(tr, uvw, batch, values);
+				m_vertices.insert(m_vertices.end(), values, values + batch);
 			}
 			if (m_attribs & MASK_COLORS)
 			{
-				color = m_mesh->sampleTriangleColor(tr, uvw);
-				m_colors.push_back(color);
+				m_mesh->sampleTriangleColors(tr, uvw, batch, values, footprint);
+				m_colors.insert(m_colors.end(), values, values + batch);
 			}
-			if (m_attribs & MASK_NORMALS)
+			if (m_attribs & (MASK_NORMALS | MASK_OCCLUSION))
 			{
-				normal = m_mesh->sampleTriangleNormal(tr, uvw);
-				m_normals.push_back(normal);
+				m_mesh->sampleTriangleNormals(tr, uvw, batch, values);
+				m_normals.insert(m_normals.end(), values, values + batch);
 			}
-			m_total_samples++;
+			if (m_attribs & MASK_OCCLUSION)
+				m_triangles.insert(m_triangles.end(), batch, (uint32_t)tr);
+			m_total_samples += batch;
+			chunk_fill += batch;
+			remaining -= batch;
 
 			// flush buffer to PLY file if chunk size has been reached.
-			if (m_vertices.size() >= m_chunk_samples ||
-				m_normals.size() >= m_chunk_samples ||
-				m_colors.size() >= m_chunk_samples)
+			if (chunk_fill >= m_chunk_samples)
 			{
 				writeChunk();
+				chunk_fill = 0;
 			}
-
 		}
 
 	}
+	m_mesh->adviseAccess(MAPPED_ADVICE_NORMAL);
 
 	writeChunk();
 
 	return true;
 }
 
+bool MeshSampler::sampleSDF()
+{
+	m_vertices.clear();
+	m_colors.clear();
+	m_normals.clear();
+	m_distances.clear();
+	m_total_samples = 0;
+
+	if (m_mesh->m_bvh.empty())
+		m_mesh->buildBVH();
+	if (m_mesh->m_area_cdf.size() != m_mesh->getNumTriangles())
+		m_mesh->computeAreaCDF();
+	WindingNumber winding;
+	winding.build(m_mesh);
+
+	// uniform samples are drawn in a slightly enlarged bounding box
+	float diagonal = glm::length(m_mesh->m_max - m_mesh->m_min);
+	glm::vec3 box_min = m_mesh->m_min - glm::vec3(0.05f * diagonal);
+	glm::vec3 box_max = m_mesh->m_max + glm::vec3(0.05f * diagonal);
+	float sigma = m_sdf_sigma * diagonal;
+	unsigned int seed = std::random_device()();
+
+	printf("Progress: %4.1f%%", 0.0f);
+
+	while (m_total_samples < m_requested_samples)
+	{
+		long long n = (long long) std::min(m_chunk_samples, m_requested_samples - m_total_samples);
+		m_vertices.resize(n);
+		m_distances.resize(n);
+		if (m_attribs & MASK_NORMALS) m_normals.resize(n);
+
+#pragma omp parallel
+		{
+			std::seed_seq seq{ seed, (unsigned int) m_total_samples, (unsigned int) omp_get_thread_num() };
+			std::mt19937 gen(seq);
+			std::normal_distribution<float> offset(0.0f, sigma);
+
+#pragma omp for schedule(dynamic, 1024)
+			for (long long i = 0; i < n; i++)
+			{
+				float type = sampleUniform0to1(gen);
+				glm::vec3 pos, normal, cp;
+				float distance = 0.0f;
+				if (type < m_sdf_uniform)
+				{
+					glm::vec3 xi = glm::vec3(sampleUniform0to1(gen), sampleUniform0to1(gen), sampleUniform0to1(gen));
+					pos = box_min + xi * (box_max - box_min);
+					distance = m_mesh->getPointToMeshSignedDistance(pos, cp, normal, winding);
+				}
+				else
+				{
+					size_t tr = m_mesh->sampleTriangleByArea(sampleUniform0to1d(gen));
+					float xsi = sampleUniform0to1(gen);
+					float psi = sampleUniform0to1(gen);
+					if (xsi + psi > 1.0f)
+					{
+						xsi = 1.0f - xsi;
+						psi = 1.0f - psi;
+					}
+					glm::vec3 uvw = glm::vec3(1.0f - xsi - psi, xsi, psi);
+					pos = m_mesh->sampleTrianglePosition(tr, uvw);
+					if (type < m_sdf_uniform + m_sdf_near)
+					{
+						pos += m_mesh->m_face_normals[tr] * offset(gen);
+						distance = m_mesh->getPointToMeshSignedDistance(pos, cp, normal, winding);
+					}
+					else if (m_attribs & MASK_NORMALS)
+						normal = m_mesh->sampleTriangleNormal(tr, uvw);
+				}
+				m_vertices[i] = pos;
+				m_distances[i] = distance;
+				if (m_attribs & MASK_NORMALS) m_normals[i] = normal;
+			}
+		}
+
+		m_total_samples += n;
+		if (!writeChunk())
+			return false;
+	}
+
+	return true;
+}
+
+bool MeshSampler::sampleVolume()
+{
+	m_vertices.clear();
+	m_occupancy.clear();
+	m_total_samples = 0;
+
+	WindingNumber winding;
+	winding.build(m_mesh);
+
+	float diagonal = glm::length(m_mesh->m_max - m_mesh->m_min);
+	glm::vec3 box_min = m_mesh->m_min - glm::vec3(0.05f * diagonal);
+	glm::vec3 box_max = m_mesh->m_max + glm::vec3(0.05f * diagonal);
+	unsigned int seed = std::random_device()();
+
+	printf("Progress: %4.1f%%", 0.0f);
+
+	while (m_total_samples < m_requested_samples)
+	{
+		long long n = (long long) std::min(m_chunk_samples, m_requested_samples - m_total_samples);
+		m_vertices.resize(n);
+		m_occupancy.resize(n);
+
+#pragma omp parallel
+		{
+			std::seed_seq seq{ seed, (unsigned int) m_total_samples, (unsigned int) omp_get_thread_num() };
+			std::mt19937 gen(seq);
+
+#pragma omp for schedule(dynamic, 1024)
+			for (long long i = 0; i < n; i++)
+			{
+				glm::vec3 xi = glm::vec3(sampleUniform0to1(gen), sampleUniform0to1(gen), sampleUniform0to1(gen));
+				m_vertices[i] = box_min + xi * (box_max - box_min);
+				m_occupancy[i] = winding.inside(m_vertices[i]) ? 1 : 0;
+			}
+		}
+
+		m_total_samples += n;
+		if (!writeChunk())
+			return false;
+	}
+
+	return true;
+}
+
 void MeshSampler::setTextureFiltering(int f)
 {
 	TextureManager::getInstance().setSamplingMethod(f); 
@@ -122,12 +482,39 @@ bool MeshSampler::sample()
 {
 	bool ok = true;
 
+	if (m_mode == SAMPLER_MODE_SDF)
+	{
+		// every point carries its signed distance; colors are only defined on the surface
+		m_attribs = (m_attribs | MASK_DISTANCE) & ~(MASK_COLORS | MASK_OCCLUSION);
+		computeChunkSamples();
+	}
+	else if (m_mode == SAMPLER_MODE_VOLUME)
+	{
+		m_attribs = MASK_VERTICES | MASK_OCCUPANCY;
+		computeChunkSamples();
+	}
+
 	if (!plyInit(m_output, m_attribs, 0))
 		return false;
 
 
 	if (m_mode == SAMPLER_MODE_UNIFORM)
+	{
+		if (m_visibility_views > 0)
+			computeVisibility();
+		if (!m_weights.empty() && !(m_weighted_area > 0.0))
+		{
+			printf("No visible triangles to sample\n");
+			return false;
+		}
+		if (m_texture_order && (m_attribs & MASK_COLORS))
+			computeTextureOrder();
 		ok = sampleUniform();
+	}
+	else if (m_mode == SAMPLER_MODE_SDF)
+		ok = sampleSDF();
+	else if (m_mode == SAMPLER_MODE_VOLUME)
+		ok = sampleVolume();
 	else
 		return false;
 
@@ -140,5 +527,5 @@ bool MeshSampler::sample()
 	}
 
 	printf("done.\n");
-
+	return true;
 }
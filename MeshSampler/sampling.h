@@ -1,10 +1,18 @@
 #pragma once
 #include <glm/glm.hpp>
 #include <vector>
+#include <random>
 #include "ply.h"
 #include "defs.h"
 
+// number of samples of a triangle processed together
+#define SAMPLE_BATCH_SIZE 256
+
 float sampleUniform0to1();
+float sampleUniform0to1(std::mt19937& gen);
+// double precision draws, for choices among more than 2^24 items
+double sampleUniform0to1d();
+double sampleUniform0to1d(std::mt19937& gen);
 
 glm::vec3 sampleUnitSphere();
 
@@ -25,13 +33,53 @@ class MeshSampler
 	std::vector<glm::vec3> m_vertices;
 	std::vector<glm::vec3> m_colors;
 	std::vector<glm::vec3> m_normals;
+	std::vector<float> m_distances;
+	std::vector<unsigned char> m_occupancy;
+	std::vector<float> m_occlusion;
+	std::vector<uint32_t> m_triangles; // triangle of each sample, the occlusion rays start from it
+
+	// ambient occlusion: rays per sample and maximum occluder distance relative to the
+	// bounding box diagonal (0 for unbounded)
+	int m_ao_rays = 16;
+	float m_ao_distance = 0.0f;
+
+	// signed distance sampling: std deviation of the offsets along the normal, relative to the
+	// bounding box diagonal, and fractions of near-surface and uniform bounding box samples
+	float m_sdf_sigma = 0.005f;
+	float m_sdf_near = 0.5f;
+	float m_sdf_uniform = 0.1f;
+
+	// visibility pre-pass: number of views, viewpoint distance from the bounding box center
+	// relative to its diagonal (0 for directions at infinity) and budget re-weighting
+	int m_visibility_views = 0;
+	float m_visibility_distance = 0.0f;
+	bool m_visibility_weighting = false;
+
+	// per-triangle sample budget weights, empty for plain area-proportional sampling
+	std::vector<float> m_weights;
+	double m_weighted_area = 0.0;
+
+	// texture-coherent scheduling: triangles visited grouped by color texture and in UV Morton
+	// order within each texture; empty for mesh order
+	bool m_texture_order = false;
+	std::vector<uint32_t> m_order;
 
 	void computeChunkSamples();
 
 	bool writeChunk();
 
+	void computeVisibility();
+
+	void computeOcclusion();
+
+	void computeTextureOrder();
+
 	bool sampleUniform();
 
+	bool sampleSDF();
+
+	bool sampleVolume();
+
 public:
 	MeshSampler() {}
 	MeshSampler(Mesh* m) { m_mesh = m; }
@@ -47,6 +95,26 @@ public:
 	void setMode(int mode) { m_mode = mode; }
 	void setNumSamples(size_t n) { m_requested_samples = n; }
 	void setTextureFiltering(int f); 
+	// Restrict the sample budget to triangles seen from views outside the mesh, or with
+	// weighting, scale it by the fraction of views each triangle is seen from.
+	void setVisibility(int views, float distance, bool weighting)
+	{
+		m_visibility_views = views;
+		m_visibility_distance = distance;
+		m_visibility_weighting = weighting;
+	}
+	void setAmbientOcclusion(int rays, float distance)
+	{
+		m_ao_rays = rays;
+		m_ao_distance = distance;
+	}
+	void setTextureOrder(bool enable) { m_texture_order = enable; }
+	void setSDFParameters(float sigma, float near_fraction, float uniform_fraction)
+	{
+		m_sdf_sigma = sigma;
+		m_sdf_near = near_fraction;
+		m_sdf_uniform = uniform_fraction;
+	}
 	bool sample();
 
 };
\ No newline at end of file
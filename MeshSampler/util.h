@@ -2,11 +2,56 @@
 
 #include <string>
 #include <algorithm>
+#include <cstdint>
 #include "glm/glm.hpp"
 
 
 float distanceSquare(glm::vec3 a);
 
+// interleaves the bits of 2D coordinates in [0, 1], 16 bits per axis
+inline uint32_t mortonCode2D(float x, float y)
+{
+	auto spread = [](uint32_t v)
+	{
+		v = (v | (v << 8)) & 0x00ff00ffu;
+		v = (v | (v << 4)) & 0x0f0f0f0fu;
+		v = (v | (v << 2)) & 0x33333333u;
+		v = (v | (v << 1)) & 0x55555555u;
+		return v;
+	};
+	uint32_t ix = (uint32_t)std::min(std::max(x * 65536.0f, 0.0f), 65535.0f);
+	uint32_t iy = (uint32_t)std::min(std::max(y * 65536.0f, 0.0f), 65535.0f);
+	return spread(ix) | (spread(iy) << 1);
+}
+
+// interleaves the bits of 3D coordinates in [0, 1], 21 bits per axis
+inline uint64_t mortonCode3D(float x, float y, float z)
+{
+	auto spread = [](uint64_t v)
+	{
+		v = (v | (v << 32)) & 0x001f00000000ffffull;
+		v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+		v = (v | (v << 8)) & 0x100f00f00f00f00full;
+		v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+		v = (v | (v << 2)) & 0x1249249249249249ull;
+		return v;
+	};
+	auto quantize = [](float v) { return (uint64_t)std::min(std::max(v * 2097152.0f, 0.0f), 2097151.0f); };
+	return spread(quantize(x)) | (spread(quantize(y)) << 1) | (spread(quantize(z)) << 2);
+}
+
+// 64-bit FNV-1a hash of size bytes, chained through hash
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
 char* readText(const char* filename);
 
 std::string getFolderPath(const char* filename);
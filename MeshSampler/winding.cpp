@@ -0,0 +1,112 @@
+#include "winding.h"
+#include "mesh.h"
+#include <omp.h>
+
+#define INV_4PI 0.0795774715f
+
+void WindingNumber::build(Mesh* mesh)
+{
+	m_mesh = mesh;
+	if (mesh->m_bvh.empty())
+		mesh->buildBVH();
+
+	const BVH& bvh = mesh->m_bvh;
+	long long num_nodes = (long long)bvh.m_nodes.size();
+	m_dipoles.resize(num_nodes);
+
+	// leaves directly from their triangles
+#pragma omp parallel for schedule(dynamic, 256)
+	for (long long i = 0; i < num_nodes; i++)
+	{
+		const BVHNode& node = bvh.m_nodes[i];
+		if (node.m_count == 0)
+			continue;
+		Dipole& d = m_dipoles[i];
+		d.m_normal = glm::vec3(0.0f);
+		glm::vec3 center = glm::vec3(0.0f);
+		float area = 0.0f;
+		for (uint32_t k = node.m_offset; k < node.m_offset + node.m_count; k++)
+		{
+			uint32_t trid = bvh.m_indices[k];
+			float tr_area = mesh->m_triangle_areas[trid];
+			if (!(tr_area > 0.0f))
+				continue;
+			const IndexBuffer& tv = mesh->m_vertex_indices;
+			glm::vec3 centroid = (mesh->m_vertex_buffer[tv[3 * (size_t)trid + 0]] + mesh->m_vertex_buffer[tv[3 * (size_t)trid + 1]] +
+				mesh->m_vertex_buffer[tv[3 * (size_t)trid + 2]]) / 3.0f;
+			d.m_normal += tr_area * mesh->m_face_normals[trid];
+			center += tr_area * centroid;
+			area += tr_area;
+		}
+		d.m_center = area > 0.0f ? center / area : 0.5f * (node.m_min + node.m_max);
+		d.m_area = area;
+	}
+
+	// inner nodes bottom-up; children always follow their parent in the node array
+	for (long long i = num_nodes - 1; i >= 0; i--)
+	{
+		const BVHNode& node = bvh.m_nodes[i];
+		if (node.m_count == 0)
+		{
+			const Dipole& left = m_dipoles[i + 1];
+			const Dipole& right = m_dipoles[node.m_offset];
+			Dipole& d = m_dipoles[i];
+			d.m_normal = left.m_normal + right.m_normal;
+			d.m_area = left.m_area + right.m_area;
+			d.m_center = d.m_area > 0.0f ? (left.m_area * left.m_center + right.m_area * right.m_center) / d.m_area :
+				0.5f * (node.m_min + node.m_max);
+		}
+		// conservative radius: farthest corner of the node box
+		Dipole& d = m_dipoles[i];
+		d.m_radius = glm::length(glm::max(glm::abs(d.m_center - node.m_min), glm::abs(node.m_max - d.m_center)));
+	}
+}
+
+float WindingNumber::triangleSolidAngle(uint32_t trid, const glm::vec3& q) const
+{
+	// [Van Oosterom and Strackee 1983]
+	const IndexBuffer& tv = m_mesh->m_vertex_indices;
+	glm::vec3 a = m_mesh->m_vertex_buffer[tv[3 * (size_t)trid + 0]] - q;
+	glm::vec3 b = m_mesh->m_vertex_buffer[tv[3 * (size_t)trid + 1]] - q;
+	glm::vec3 c = m_mesh->m_vertex_buffer[tv[3 * (size_t)trid + 2]] - q;
+	float la = glm::length(a), lb = glm::length(b), lc = glm::length(c);
+	float numerator = glm::dot(a, glm::cross(b, c));
+	float denominator = la * lb * lc + glm::dot(a, b) * lc + glm::dot(b, c) * la + glm::dot(c, a) * lb;
+	if (numerator == 0.0f && denominator <= 0.0f)
+		return 0.0f; // q lies on the triangle plane
+	return 2.0f * atan2f(numerator, denominator);
+}
+
+float WindingNumber::evaluate(const glm::vec3& q) const
+{
+	const BVH& bvh = m_mesh->m_bvh;
+	if (bvh.empty())
+		return 0.0f;
+
+	uint32_t stack[2 * BVH_MAX_DEPTH];
+	int sp = 0;
+	stack[sp++] = 0;
+	float w = 0.0f;
+	while (sp > 0)
+	{
+		uint32_t id = stack[--sp];
+		const BVHNode& node = bvh.m_nodes[id];
+		const Dipole& d = m_dipoles[id];
+		glm::vec3 dir = d.m_center - q;
+		float dist2 = glm::dot(dir, dir);
+		if (dist2 > WINDING_BETA * WINDING_BETA * d.m_radius * d.m_radius)
+		{
+			w += glm::dot(dir, d.m_normal) / (dist2 * sqrtf(dist2));
+			continue;
+		}
+		if (node.m_count > 0)
+		{
+			for (uint32_t k = node.m_offset; k < node.m_offset + node.m_count; k++)
+				w += triangleSolidAngle(bvh.m_indices[k], q);
+			continue;
+		}
+		stack[sp++] = id + 1;
+		stack[sp++] = node.m_offset;
+	}
+	return w * INV_4PI;
+}
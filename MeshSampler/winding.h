@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+// Accuracy parameter of the far field approximation: a BVH node is replaced by its dipole
+// when the query point is farther than WINDING_BETA times the node radius from its center.
+#define WINDING_BETA 2.0f
+
+// Fast generalized winding number evaluation over the triangles of a mesh [Barill et al. 2018].
+// Uses the mesh BVH, storing a first order (dipole) expansion of the triangles under each node.
+// The winding number is ~1 inside, ~0 outside and degrades gracefully for meshes with holes or
+// self-intersections, so it is used for inside/outside classification of non-watertight meshes.
+class WindingNumber
+{
+	struct Dipole
+	{
+		glm::vec3 m_center;  // area-weighted centroid of the triangles
+		float m_radius = 0.0f;
+		glm::vec3 m_normal;  // sum of area-weighted triangle normals
+		float m_area = 0.0f;
+	};
+
+	const class Mesh* m_mesh = nullptr;
+	std::vector<Dipole> m_dipoles; // one per BVH node
+
+	float triangleSolidAngle(uint32_t trid, const glm::vec3& q) const;
+
+public:
+	// builds the mesh BVH too, if not present
+	void build(Mesh* mesh);
+	float evaluate(const glm::vec3& q) const;
+	bool inside(const glm::vec3& q) const { return evaluate(q) > 0.5f; }
+};